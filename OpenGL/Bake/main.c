@@ -0,0 +1,415 @@
+//Offline texture baker: decodes PNG/JPG once, builds the full mip chain and
+//writes it (optionally block compressed) into the container in ../Baked.h,
+//which Land maps and uploads without decoding.
+//
+//./a.out [-f auto|rgba|bc1|bc3|bc7] [-o out.ltex] image...
+//
+//Without -o each image is written next to itself as name.ltex. auto picks
+//BC1 for opaque images and BC3 when there is alpha.
+
+#include "../SOIL.h"
+#include "../Baked.h"
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+
+using namespace std;
+
+/////////////////////Mips
+//Levels are kept as linear-light floats so averaging does not darken, and
+//converted back to sRGB bytes for storage.
+
+float srgbToLinear[256];
+
+void initSrgb(){
+	for (int n = 0; n < 256; n++){
+		float c = n / 255.0f;
+		srgbToLinear[n] = c <= .04045f ? c / 12.92f : pow((c + .055f) / 1.055f, 2.4f);
+	}
+}
+
+unsigned char linearToSrgb(float c){
+	c = c <= .0031308f ? c * 12.92f : 1.055f * pow(c, 1 / 2.4f) - .055f;
+	int n = (int)(c * 255 + .5f);
+	return n < 0 ? 0 : n > 255 ? 255 : n;
+}
+
+struct Level {
+	int w, h;
+	vector<float> rgba;	//linear color, straight alpha
+};
+
+//2x2 box filter; odd edges reuse the last row or column
+void downsample(const Level &src, Level &dst){
+	dst.w = src.w > 1 ? src.w / 2 : 1;
+	dst.h = src.h > 1 ? src.h / 2 : 1;
+	dst.rgba.resize(dst.w * dst.h * 4);
+	for (int y = 0; y < dst.h; y++){
+		int y0 = min(y*2, src.h-1), y1 = min(y*2+1, src.h-1);
+		for (int x = 0; x < dst.w; x++){
+			int x0 = min(x*2, src.w-1), x1 = min(x*2+1, src.w-1);
+			for (int c = 0; c < 4; c++){
+				dst.rgba[(y*dst.w + x)*4 + c] = .25f * (
+					src.rgba[(y0*src.w + x0)*4 + c] + src.rgba[(y0*src.w + x1)*4 + c] +
+					src.rgba[(y1*src.w + x0)*4 + c] + src.rgba[(y1*src.w + x1)*4 + c]);
+			}
+		}
+	}
+}
+
+void toBytes(const Level &l, vector<unsigned char> &out){
+	out.resize(l.w * l.h * 4);
+	for (int n = 0; n < l.w * l.h; n++){
+		for (int c = 0; c < 3; c++){
+			out[n*4 + c] = linearToSrgb(l.rgba[n*4 + c]);
+		}
+		int a = (int)(l.rgba[n*4 + 3] * 255 + .5f);
+		out[n*4 + 3] = a < 0 ? 0 : a > 255 ? 255 : a;
+	}
+}
+
+/////////////////////Block Compression
+//Endpoints come from the principal axis of each 4x4 block; indices pick the
+//nearest palette entry. Not an exhaustive search, but far better than the
+//bounding box on diagonal gradients.
+
+//Principal axis of px over the first n channels, ends inset by 1/16
+void fitEndpoints(const float px[16][4], int n, float lo[4], float hi[4]){
+	float mean[4] = {0,0,0,0};
+	for (int i = 0; i < 16; i++) for (int c = 0; c < n; c++) mean[c] += px[i][c] / 16;
+
+	float cov[4][4] = {};
+	for (int i = 0; i < 16; i++){
+		for (int a = 0; a < n; a++){
+			for (int b = 0; b < n; b++){
+				cov[a][b] += (px[i][a] - mean[a]) * (px[i][b] - mean[b]);
+			}
+		}
+	}
+
+	//Power iteration from the widest channel
+	float axis[4] = {0,0,0,0};
+	int widest = 0;
+	for (int c = 1; c < n; c++) if (cov[c][c] > cov[widest][widest]) widest = c;
+	axis[widest] = 1;
+	for (int it = 0; it < 8; it++){
+		float next[4] = {0,0,0,0};
+		float len = 0;
+		for (int a = 0; a < n; a++){
+			for (int b = 0; b < n; b++) next[a] += cov[a][b] * axis[b];
+			len += next[a] * next[a];
+		}
+		if (len < 1e-12f) break;
+		len = 1 / sqrt(len);
+		for (int a = 0; a < n; a++) axis[a] = next[a] * len;
+	}
+
+	float tmin = 1e30f, tmax = -1e30f;
+	for (int i = 0; i < 16; i++){
+		float t = 0;
+		for (int c = 0; c < n; c++) t += (px[i][c] - mean[c]) * axis[c];
+		tmin = min(tmin, t);
+		tmax = max(tmax, t);
+	}
+	float inset = (tmax - tmin) / 16;
+	tmin += inset;
+	tmax -= inset;
+	for (int c = 0; c < n; c++){
+		lo[c] = min(255.0f, max(0.0f, mean[c] + axis[c] * tmin));
+		hi[c] = min(255.0f, max(0.0f, mean[c] + axis[c] * tmax));
+	}
+}
+
+int nearest(const float p[4], const float palette[][4], int count, int n){
+	int best = 0;
+	float bestError = 1e30f;
+	for (int k = 0; k < count; k++){
+		float e = 0;
+		for (int c = 0; c < n; c++){
+			float d = p[c] - palette[k][c];
+			e += d * d;
+		}
+		if (e < bestError){ bestError = e; best = k; }
+	}
+	return best;
+}
+
+unsigned short pack565(const float c[4]){
+	int r = (int)(c[0] * 31 / 255 + .5f);
+	int g = (int)(c[1] * 63 / 255 + .5f);
+	int b = (int)(c[2] * 31 / 255 + .5f);
+	return (r << 11) | (g << 5) | b;
+}
+
+void unpack565(unsigned short v, float c[4]){
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+	c[3] = 255;
+}
+
+//BC1 color block, always in four color mode
+void encodeBC1(const float px[16][4], unsigned char* out){
+	float lo[4], hi[4];
+	fitEndpoints(px, 3, lo, hi);
+	unsigned short c0 = pack565(hi), c1 = pack565(lo);
+	if (c0 < c1) swap(c0, c1);
+
+	float palette[4][4];
+	unpack565(c0, palette[0]);
+	unpack565(c1, palette[1]);
+	for (int c = 0; c < 3; c++){
+		palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+	}
+
+	unsigned int indices = 0;
+	if (c0 != c1){
+		for (int i = 0; i < 16; i++){
+			indices |= nearest(px[i], palette, 4, 3) << (i*2);
+		}
+	}
+	out[0] = c0 & 255; out[1] = c0 >> 8;
+	out[2] = c1 & 255; out[3] = c1 >> 8;
+	for (int k = 0; k < 4; k++) out[4+k] = (indices >> (k*8)) & 255;
+}
+
+//BC3 alpha block, eight value mode
+void encodeBC3Alpha(const float px[16][4], unsigned char* out){
+	float a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++){
+		a0 = max(a0, px[i][3]);
+		a1 = min(a1, px[i][3]);
+	}
+	int e0 = (int)(a0 + .5f), e1 = (int)(a1 + .5f);
+	float palette[8][4];
+	palette[0][0] = e0;
+	palette[1][0] = e1;
+	for (int k = 1; k < 7; k++){
+		palette[k+1][0] = ((7-k)*e0 + k*e1) / 7.0f;
+	}
+
+	uint64_t indices = 0;
+	if (e0 != e1){
+		for (int i = 0; i < 16; i++){
+			float a[4] = { px[i][3] };
+			indices |= (uint64_t)nearest(a, palette, 8, 1) << (i*3);
+		}
+	}
+	out[0] = e0;
+	out[1] = e1;
+	for (int k = 0; k < 6; k++) out[2+k] = (indices >> (k*8)) & 255;
+}
+
+void encodeBC3(const float px[16][4], unsigned char* out){
+	encodeBC3Alpha(px, out);
+	encodeBC1(px, out + 8);
+}
+
+//LSB-first bit writer for 128 bit BC7 blocks
+struct Bits {
+	unsigned char* out;
+	int at;
+	void put(unsigned int v, int n){
+		for (int k = 0; k < n; k++, at++){
+			if ((v >> k) & 1) out[at >> 3] |= 1 << (at & 7);
+		}
+	}
+};
+
+//7 bit endpoint plus shared p-bit, whichever p-bit lands closer
+void quantizeBC7(const float e[4], int q[4], int &p){
+	float best = 1e30f;
+	for (int pb = 0; pb < 2; pb++){
+		int t[4];
+		float err = 0;
+		for (int c = 0; c < 4; c++){
+			int v = (int)((e[c] - pb) / 2 + .5f);
+			t[c] = v < 0 ? 0 : v > 127 ? 127 : v;
+			float d = ((t[c] << 1) | pb) - e[c];
+			err += d * d;
+		}
+		if (err < best){
+			best = err;
+			p = pb;
+			memcpy(q, t, sizeof(t));
+		}
+	}
+}
+
+//BC7 mode 6: one subset, RGBA endpoints, 4 bit indices
+void encodeBC7(const float px[16][4], unsigned char* out){
+	static const int weights[16] = { 0,4,9,13,17,21,26,30,34,38,43,47,51,55,60,64 };
+	float lo[4], hi[4];
+	fitEndpoints(px, 4, lo, hi);
+	int q[2][4], p[2];
+	quantizeBC7(lo, q[0], p[0]);
+	quantizeBC7(hi, q[1], p[1]);
+
+	float palette[16][4];
+	for (int k = 0; k < 16; k++){
+		for (int c = 0; c < 4; c++){
+			int e0 = (q[0][c] << 1) | p[0], e1 = (q[1][c] << 1) | p[1];
+			palette[k][c] = ((64 - weights[k]) * e0 + weights[k] * e1 + 32) >> 6;
+		}
+	}
+	int indices[16];
+	for (int i = 0; i < 16; i++) indices[i] = nearest(px[i], palette, 16, 4);
+
+	//The first index is stored without its top bit, so it must be below 8
+	if (indices[0] & 8){
+		for (int c = 0; c < 4; c++) swap(q[0][c], q[1][c]);
+		swap(p[0], p[1]);
+		for (int i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+	}
+
+	memset(out, 0, 16);
+	Bits b = { out, 0 };
+	b.put(1 << 6, 7);
+	for (int c = 0; c < 4; c++){
+		b.put(q[0][c], 7);
+		b.put(q[1][c], 7);
+	}
+	b.put(p[0], 1);
+	b.put(p[1], 1);
+	b.put(indices[0], 3);
+	for (int i = 1; i < 16; i++) b.put(indices[i], 4);
+}
+
+void compress(const vector<unsigned char> &rgba, int w, int h, int format, vector<unsigned char> &out){
+	int block = bakedBlockBytes(format);
+	int bw = (w + 3) / 4, bh = (h + 3) / 4;
+	out.assign(bw * bh * block, 0);
+	for (int by = 0; by < bh; by++){
+		for (int bx = 0; bx < bw; bx++){
+			float px[16][4];
+			for (int i = 0; i < 16; i++){
+				int x = min(bx*4 + i%4, w-1), y = min(by*4 + i/4, h-1);
+				for (int c = 0; c < 4; c++) px[i][c] = rgba[(y*w + x)*4 + c];
+			}
+			unsigned char* dst = &out[(by*bw + bx) * block];
+			if (format == BAKED_BC1) encodeBC1(px, dst);
+			else if (format == BAKED_BC3) encodeBC3(px, dst);
+			else encodeBC7(px, dst);
+		}
+	}
+}
+
+/////////////////////Container
+
+bool bake(const char* input, const char* output, int format){
+	int w, h;
+	unsigned char* image = SOIL_load_image(input, &w, &h, 0, SOIL_LOAD_RGBA);
+	if (!image){
+		fprintf(stderr, "%s: could not decode\n", input);
+		return false;
+	}
+
+	if (format < 0){
+		bool opaque = true;
+		for (int n = 0; n < w*h && opaque; n++) opaque = image[n*4 + 3] == 255;
+		format = opaque ? BAKED_BC1 : BAKED_BC3;
+	}
+
+	vector<Level> levels(1);
+	levels[0].w = w;
+	levels[0].h = h;
+	levels[0].rgba.resize(w * h * 4);
+	for (int n = 0; n < w*h; n++){
+		for (int c = 0; c < 3; c++) levels[0].rgba[n*4 + c] = srgbToLinear[image[n*4 + c]];
+		levels[0].rgba[n*4 + 3] = image[n*4 + 3] / 255.0f;
+	}
+	SOIL_free_image_data(image);
+	while ((levels.back().w > 1 || levels.back().h > 1) && levels.size() < BAKED_MAX_LEVELS){
+		Level next;
+		downsample(levels.back(), next);
+		levels.push_back(next);
+	}
+
+	BakedHeader header = { BAKED_MAGIC, BAKED_VERSION, (uint32_t)format,
+		(uint32_t)w, (uint32_t)h, (uint32_t)levels.size() };
+	vector<BakedLevel> table(levels.size());
+	vector< vector<unsigned char> > data(levels.size());
+	uint32_t offset = sizeof(header) + table.size() * sizeof(BakedLevel);
+	for (size_t l = 0; l < levels.size(); l++){
+		vector<unsigned char> bytes;
+		toBytes(levels[l], bytes);
+		if (format == BAKED_RGBA8) data[l].swap(bytes);
+		else compress(bytes, levels[l].w, levels[l].h, format, data[l]);
+
+		offset = (offset + 15) & ~15u;
+		table[l].width = levels[l].w;
+		table[l].height = levels[l].h;
+		table[l].offset = offset;
+		table[l].size = data[l].size();
+		offset += data[l].size();
+	}
+
+	FILE* f = fopen(output, "wb");
+	if (!f){
+		fprintf(stderr, "%s: could not write\n", output);
+		return false;
+	}
+	static const char zeros[16] = {};
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&table[0], sizeof(BakedLevel), table.size(), f);
+	for (size_t l = 0; l < levels.size(); l++){
+		fwrite(zeros, 1, table[l].offset - ftell(f), f);
+		fwrite(&data[l][0], 1, data[l].size(), f);
+	}
+	fclose(f);
+
+	static const char* names[] = { "rgba8", "bc1", "bc3", "bc7" };
+	printf("%s -> %s  %dx%d %s, %d levels, %u bytes\n", input, output, w, h,
+		names[format], (int)levels.size(), offset);
+	return true;
+}
+
+string bakedName(const char* input){
+	string s = input;
+	size_t dot = s.find_last_of('.');
+	size_t slash = s.find_last_of('/');
+	if (dot != string::npos && (slash == string::npos || dot > slash)) s.erase(dot);
+	return s + ".ltex";
+}
+
+int main(int argc, char** argv){
+	int format = -1;
+	const char* output = 0;
+	vector<const char*> inputs;
+
+	for (int n = 1; n < argc; n++){
+		if (!strcmp(argv[n], "-f") && n+1 < argc){
+			const char* f = argv[++n];
+			if (!strcmp(f, "auto")) format = -1;
+			else if (!strcmp(f, "rgba")) format = BAKED_RGBA8;
+			else if (!strcmp(f, "bc1")) format = BAKED_BC1;
+			else if (!strcmp(f, "bc3")) format = BAKED_BC3;
+			else if (!strcmp(f, "bc7")) format = BAKED_BC7;
+			else {
+				fprintf(stderr, "unknown format %s\n", f);
+				return 1;
+			}
+		}else if (!strcmp(argv[n], "-o") && n+1 < argc){
+			output = argv[++n];
+		}else{
+			inputs.push_back(argv[n]);
+		}
+	}
+	if (inputs.empty() || (output && inputs.size() > 1)){
+		fprintf(stderr, "usage: %s [-f auto|rgba|bc1|bc3|bc7] [-o out.ltex] image...\n", argv[0]);
+		return 1;
+	}
+
+	initSrgb();
+	int failed = 0;
+	for (size_t n = 0; n < inputs.size(); n++){
+		string out = output ? output : bakedName(inputs[n]);
+		if (!bake(inputs[n], out.c_str(), format)) failed++;
+	}
+	return failed ? 1 : 0;
+}
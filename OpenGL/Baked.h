@@ -0,0 +1,48 @@
+//Baked texture container, written by Bake/ and mapped directly by Land/.
+//
+//  BakedHeader
+//  BakedLevel[levels]   largest first
+//  level data           each level starts on a 16 byte boundary
+//
+//Integers are little endian. RGBA8 levels are tightly packed rows; BCn
+//levels are 4x4 blocks in row order, partial blocks padded by clamping.
+
+#ifndef BAKED_H
+#define BAKED_H
+
+#include <stdint.h>
+
+#define BAKED_MAGIC 0x5845544c	//"LTEX"
+#define BAKED_VERSION 1
+#define BAKED_MAX_LEVELS 16
+
+enum { BAKED_RGBA8, BAKED_BC1, BAKED_BC3, BAKED_BC7 };
+
+struct BakedHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levels;
+};
+
+struct BakedLevel {
+	uint32_t width;
+	uint32_t height;
+	uint32_t offset;	//from the start of the file
+	uint32_t size;
+};
+
+//Bytes per 4x4 block, or 0 for RGBA8
+inline int bakedBlockBytes(uint32_t format){
+	return format == BAKED_BC1 ? 8 : format == BAKED_RGBA8 ? 0 : 16;
+}
+
+inline uint32_t bakedLevelSize(uint32_t format, uint32_t w, uint32_t h){
+	int block = bakedBlockBytes(format);
+	if (block == 0) return w * h * 4;
+	return ((w + 3) / 4) * ((h + 3) / 4) * block;
+}
+
+#endif
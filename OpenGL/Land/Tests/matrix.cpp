@@ -0,0 +1,118 @@
+//Parity of Land's Matrix4 with the scalar one it replaced (matrix_reference.h).
+//Random sequences of the operations Land uses are applied to both; every
+//element must compare equal after every step. 'make test' builds and runs it.
+//
+//Equal means ==, so -0 and +0 count as the same: when the right-hand side of
+//concat is affine the new code skips the a3 * 0 term, and a sum that is -0
+//without it stays -0 where the old code got +0. Steps that leave a
+//non-finite element end the sequence, since inf - inf orders differ.
+
+#define main land_main
+#include "../main.c"
+#undef main
+
+#include "matrix_reference.h"
+
+//Values like Land's: angles, positions and scales of a few dozen units
+static float randomValue(){
+	return (rand() % 2000 - 1000) / 37.0f;
+}
+
+//Rotation axes, often axis-aligned so the two-column rotate paths run too
+static float randomAxis(){
+	int r = rand() % 4;
+	return r == 0 ? 0 : r == 1 ? randomValue() : r == 2 ? 1 : -1;
+}
+
+static bool same(const float* a, const float* b){
+	for (int n = 0; n < 16; n++){
+		if (!(a[n] == b[n]) && !(isnan(a[n]) && isnan(b[n]))) return false;
+	}
+	return true;
+}
+
+static bool allFinite(const float* a){
+	for (int n = 0; n < 16; n++){
+		if (!isfinite(a[n])) return false;
+	}
+	return true;
+}
+
+static void printMatrix(const char* name, const float* e){
+	printf("  %s:", name);
+	for (int n = 0; n < 16; n++) printf(" %g", e[n]);
+	printf("\n");
+}
+
+int main(int argc, char** argv){
+	int sequences = argc > 1 ? atoi(argv[1]) : 200000;
+	const char* names[] = { "setTranslate", "translate", "setScale", "scale", "setRotate",
+		"rotate", "setPerspective", "setLookAt", "concat", "setMultiply", "transpose" };
+	srand(1);
+	long steps = 0, failed = 0;
+
+	for (int s = 0; s < sequences; s++){
+		reference::Matrix4 a;
+		Matrix4 b;
+		for (int step = 0; step < 6; step++){
+			int op = rand() % 11;
+			float x = randomValue(), y = randomValue(), z = randomValue(), w = randomValue();
+			reference::Matrix4 ra;
+			Matrix4 rb;
+			switch (op){
+			case 0: a.setTranslate(x, y, z); b.setTranslate(x, y, z); break;
+			case 1: a.translate(x, y, z); b.translate(x, y, z); break;
+			case 2: a.setScale(x, y, z); b.setScale(x, y, z); break;
+			case 3: a.scale(x, y, z); b.scale(x, y, z); break;
+			case 4: {
+				float X = randomAxis(), Y = randomAxis(), Z = randomAxis();
+				a.setRotate(w, X, Y, Z); b.setRotate(w, X, Y, Z);
+				break;
+			}
+			case 5: {
+				float X = randomAxis(), Y = randomAxis(), Z = randomAxis();
+				if (!X && !Y && !Z) X = 1;
+				a.rotate(w, X, Y, Z); b.rotate(w, X, Y, Z);
+				break;
+			}
+			case 6:
+				a.setPerspective(30 + fabs(x), 1.75, .1, 1450);
+				b.setPerspective(30 + fabs(x), 1.75, .1, 1450);
+				break;
+			case 7:
+				a.setLookAt(x, y, z, x + 1, y - .25, z + w * .01, 0, 1, 0);
+				b.setLookAt(x, y, z, x + 1, y - .25, z + w * .01, 0, 1, 0);
+				break;
+			case 8:
+			case 9:
+				//Affine right-hand sides take the fast path; a non-zero bottom
+				//row takes the full one
+				ra.setRotate(w, x, y, z); ra.translate(y, z, x);
+				rb.setRotate(w, x, y, z); rb.translate(y, z, x);
+				if (rand() % 2) ra.elements[3] = rb.elements[3] = .5f;
+				a.concat(ra.elements);
+				if (op == 8) b.concat(rb);
+				else b.setMultiply(b, rb);
+				break;
+			case 10: a.transpose(); b.transpose(); break;
+			}
+			if (!allFinite(a.elements)) break;
+			steps++;
+			if (!same(a.elements, b.elements)){
+				if (failed++ < 5){
+					printf("sequence %d step %d: %s differs\n", s, step, names[op]);
+					printMatrix("reference", a.elements);
+					printMatrix("Matrix4  ", b.elements);
+				}
+				break;
+			}
+		}
+		Matrix4 copy;
+		copy.copyFrom(b);
+		if (memcmp(copy.elements, b.elements, sizeof(copy.elements))){
+			if (failed++ < 5) printf("sequence %d: copyFrom differs\n", s);
+		}
+	}
+	printf("Matrix4: %ld steps over %d sequences, %ld mismatches\n", steps, sequences, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,340 @@
+//Land's Matrix4 as it was before it was rewritten around SIMD columns, kept
+//verbatim as the reference for Tests/matrix.cpp. Not used by Land itself.
+//copyFrom is the old one, which read out of bounds; the test does not call it.
+
+namespace reference {
+
+struct Matrix4 {
+    float elements[16] = {1,0,0,0,  0,1,0,0,  0,0,1,0,  0,0,0,1};
+
+	void setElements(float (&e)[16]){
+		for (int n = 0; n < 16; n++){
+            elements[n] = e[n];
+        }
+	}
+
+    //Set default matrix
+    void setIdentity(){
+        float e[16];
+        e[0] = 1;   e[4] = 0;   e[8]  = 0;   e[12] = 0;
+        e[1] = 0;   e[5] = 1;   e[9]  = 0;   e[13] = 0;
+        e[2] = 0;   e[6] = 0;   e[10] = 1;   e[14] = 0;
+        e[3] = 0;   e[7] = 0;   e[11] = 0;   e[15] = 1;
+        setElements(e);
+    }
+
+    //Copies Matrix to another
+    void copyFrom(Matrix4 old){
+        for(int n = 0; n < 16; n++){
+            elements[n] = old.elements[16-n];
+        }
+    }
+
+    //Print Matrix
+    void print(){
+        for(int n = 0; n < 16; n++){
+            cout << elements[n] << " ";
+            if (n%4 == 3) cout << endl;
+        }
+        cout << endl;
+    }
+
+    //Reverse matrix
+	void transpose(){
+		float t;
+		float e[16];
+		for (int n = 0; n < 16; n++){
+            e[n] = elements[n];
+        }
+		t = e[ 1];  e[ 1] = e[ 4];  e[ 4] = t;
+		t = e[ 2];  e[ 2] = e[ 8];  e[ 8] = t;
+		t = e[ 3];  e[ 3] = e[12];  e[12] = t;
+		t = e[ 6];  e[ 6] = e[ 9];  e[ 9] = t;
+		t = e[ 7];  e[ 7] = e[13];  e[13] = t;
+		t = e[11];  e[11] = e[14];  e[14] = t;
+		setElements(e);
+	}
+
+	//SetTranslate on Translation matrix
+	void setTranslate(float x, float y, float z) {
+		float e[16];
+		for (int n = 0; n < 16; n++){
+            e[n] = elements[n];
+        }
+		e[0] = 1;  e[4] = 0;  e[8]  = 0;  e[12] = x;
+		e[1] = 0;  e[5] = 1;  e[9]  = 0;  e[13] = y;
+		e[2] = 0;  e[6] = 0;  e[10] = 1;  e[14] = z;
+		e[3] = 0;  e[7] = 0;  e[11] = 0;  e[15] = 1;
+		setElements(e);
+		return;
+	};
+
+	//Translate matrix by x, y, z - multiply by x, y, z
+	void translate(float x, float y, float z) {
+		float e[16]; 
+  		for (int n = 0; n < 16; n++){
+            e[n] = elements[n];
+        }
+		e[12] += e[0] * x + e[4] * y + e[8]  * z;
+		e[13] += e[1] * x + e[5] * y + e[9]  * z;
+		e[14] += e[2] * x + e[6] * y + e[10] * z;
+		e[15] += e[3] * x + e[7] * y + e[11] * z;
+		setElements(e);
+		return;
+	}
+
+	//SetScale on Model matrix
+	void setScale(float x, float y, float z) {
+		float e[16];
+		for (int n = 0; n < 16; n++){
+            e[n] = elements[n];
+        }
+		e[0] = x;  e[4] = 0;  e[8]  = 0;  e[12] = 0;
+		e[1] = 0;  e[5] = y;  e[9]  = 0;  e[13] = 0;
+		e[2] = 0;  e[6] = 0;  e[10] = z;  e[14] = 0;
+		e[3] = 0;  e[7] = 0;  e[11] = 0;  e[15] = 1;
+		setElements(e);
+		return;
+	};
+
+	//Scale on Model matrix, multiply by x y z
+	void scale(float x, float y, float z) {
+		float e[16];
+		for (int n = 0; n < 16; n++){
+            e[n] = elements[n];
+        }
+		e[0] *= x;  e[4] *= y;  e[8]  *= z;
+		e[1] *= x;  e[5] *= y;  e[9]  *= z;
+		e[2] *= x;  e[6] *= y;  e[10] *= z;
+		e[3] *= x;  e[7] *= y;  e[11] *= z;
+		setElements(e);
+		return;
+	};
+
+	void setRotate( float angle, float x, float y, float z) {
+		float s, c, len, rlen, nc, xy, yz, zx, xs, ys, zs;
+		float e[16];
+		for (int n = 0; n < 16; n++){
+	        e[n] = elements[n];
+	    }
+
+		angle = M_PI * angle / 180.0;
+
+		s = sin(angle);
+		c = cos(angle);
+
+		if (0 != x && 0 == y && 0 == z) {
+	    	// Rotation around X axis
+			if (x < 0) {
+				s = -s;
+			}
+			e[0] = 1;  e[4] = 0;  e[ 8] = 0;  e[12] = 0;
+			e[1] = 0;  e[5] = c;  e[ 9] =-s;  e[13] = 0;
+			e[2] = 0;  e[6] = s;  e[10] = c;  e[14] = 0;
+			e[3] = 0;  e[7] = 0;  e[11] = 0;  e[15] = 1;
+		} else if (0 == x && 0 != y && 0 == z) {
+		    // Rotation around Y axis
+		    if (y < 0) {
+				s = -s;
+		    }
+		    e[0] = c;  e[4] = 0;  e[ 8] = s;  e[12] = 0;
+		    e[1] = 0;  e[5] = 1;  e[ 9] = 0;  e[13] = 0;
+		    e[2] =-s;  e[6] = 0;  e[10] = c;  e[14] = 0;
+		    e[3] = 0;  e[7] = 0;  e[11] = 0;  e[15] = 1;
+		} else if (0 == x && 0 == y && 0 != z) {
+	    	// Rotation around Z axis
+	    	if (z < 0) {
+				s = -s;
+			}
+		    e[0] = c;  e[4] =-s;  e[ 8] = 0;  e[12] = 0;
+		    e[1] = s;  e[5] = c;  e[ 9] = 0;  e[13] = 0;
+		    e[2] = 0;  e[6] = 0;  e[10] = 1;  e[14] = 0;
+		    e[3] = 0;  e[7] = 0;  e[11] = 0;  e[15] = 1;
+		} else {
+	    	// Rotation around another axis
+	    	len = sqrt(x*x + y*y + z*z);
+	    	if (len != 1) {
+				rlen = 1 / len;
+				x *= rlen;
+				y *= rlen;
+				z *= rlen;
+			}
+			nc = 1 - c;
+			xy = x * y;
+			yz = y * z;
+			zx = z * x;
+			xs = x * s;
+			ys = y * s;
+			zs = z * s;
+
+			e[ 0] = x*x*nc +  c;
+			e[ 1] = xy *nc + zs;
+			e[ 2] = zx *nc - ys;
+			e[ 3] = 0;
+
+			e[ 4] = xy *nc - zs;
+			e[ 5] = y*y*nc +  c;
+			e[ 6] = yz *nc + xs;
+			e[ 7] = 0;
+
+			e[ 8] = zx *nc + ys;
+			e[ 9] = yz *nc - xs;
+			e[10] = z*z*nc +  c;
+			e[11] = 0;
+
+			e[12] = 0;
+			e[13] = 0;
+			e[14] = 0;
+			e[15] = 1;
+		}
+		setElements(e);
+
+		return;
+	};
+
+	void rotate( float angle, float x, float y, float z ){
+		Matrix4 temp;
+		temp.setRotate(angle, x, y, z);
+		concat( temp.elements );
+	}
+
+	void concat( float (&other)[16] ) {
+		int i;
+		float ai0, ai1, ai2, ai3;
+		float e[16];
+		float a[16];
+		float b[16];
+		// Calculate e = a * b
+		for (int n = 0; n < 16; n++){
+	        e[n] = elements[n];
+	        a[n] = elements[n];
+	        b[n] = other[n];
+	    }
+  
+		for (i = 0; i < 4; i++) {
+			ai0=a[i];  ai1=a[i+4];  ai2=a[i+8];  ai3=a[i+12];
+			e[i]    = ai0 * b[0]  + ai1 * b[1]  + ai2 * b[2]  + ai3 * b[3];
+			e[i+4]  = ai0 * b[4]  + ai1 * b[5]  + ai2 * b[6]  + ai3 * b[7];
+			e[i+8]  = ai0 * b[8]  + ai1 * b[9]  + ai2 * b[10] + ai3 * b[11];
+			e[i+12] = ai0 * b[12] + ai1 * b[13] + ai2 * b[14] + ai3 * b[15];
+		}
+		setElements(e);
+
+		return;
+	};
+
+	// Set Perspective for Perspective Matrix
+	void setPerspective(float fovy, float aspect, float near, float far) {
+		float rd, s, ct;
+
+		if (near == far || aspect == 0) {
+			cerr << 'null frustum' << endl;
+		}
+		if (near <= 0) {
+			cerr << 'near <= 0' << endl;
+		}
+		if (far <= 0) {
+			cerr << 'far <= 0' << endl;
+		}
+
+		fovy = M_PI * fovy / 180.0 / 2.0;
+  		s = sin(fovy);
+		if (s == 0) {
+			cerr << 'null frustum' << endl;
+		}
+
+		rd = 1.0 / (far - near);
+		ct = cos(fovy) / s;
+
+		float e[16]; 
+  		for (int n = 0; n < 16; n++){
+            e[n] = elements[n];
+        }
+		e[0]  = ct / aspect;
+		e[1]  = 0;
+		e[2]  = 0;
+		e[3]  = 0;
+
+		e[4]  = 0;
+		e[5]  = ct;
+		e[6]  = 0;
+		e[7]  = 0;
+
+		e[8]  = 0;
+		e[9]  = 0;
+		e[10] = -(far + near) * rd;
+		e[11] = -1;
+
+		e[12] = 0;
+		e[13] = 0;
+		e[14] = -2 * near * far * rd;
+		e[15] = 0;
+		setElements(e);
+		return;
+	}
+
+	//Set Look At for Projection Matrix
+	void setLookAt(float eyeX, float eyeY, float eyeZ, 
+				float centerX, float centerY, float centerZ, 
+				float upX, float upY, float upZ) {
+		float fx, fy, fz, rlf, sx, sy, sz, rls, ux, uy, uz;
+
+		fx = centerX - eyeX;
+		fy = centerY - eyeY;
+		fz = centerZ - eyeZ;
+
+		// Normalize f.
+		rlf = 1.0 / sqrt(fx*fx + fy*fy + fz*fz);
+		fx *= rlf;
+		fy *= rlf;
+		fz *= rlf;
+
+		// Calculate cross product of f and up.
+		sx = fy * upZ - fz * upY;
+		sy = fz * upX - fx * upZ;
+		sz = fx * upY - fy * upX;
+
+		// Normalize s.
+		rls = 1.0 / sqrt(sx*sx + sy*sy + sz*sz);
+		sx *= rls;
+		sy *= rls;
+		sz *= rls;
+
+		// Calculate cross product of s and f.
+		ux = sy * fz - sz * fy;
+		uy = sz * fx - sx * fz;
+		uz = sx * fy - sy * fx;
+
+		// Set to this.
+		float e[16]; 
+  		for (int n = 0; n < 16; n++){
+            e[n] = elements[n];
+        }
+		e[0] = sx;
+		e[1] = ux;
+		e[2] = -fx;
+		e[3] = 0;
+
+		e[4] = sy;
+		e[5] = uy;
+		e[6] = -fy;
+		e[7] = 0;
+
+		e[8] = sz;
+		e[9] = uz;
+		e[10] = -fz;
+		e[11] = 0;
+
+		e[12] = 0;
+		e[13] = 0;
+		e[14] = 0;
+		e[15] = 1;
+		setElements(e);
+		// Translate.
+		translate(-eyeX, -eyeY, -eyeZ);
+		return;
+	};
+
+};
+
+}
@@ -5,132 +5,808 @@
 
 #include <GL/glew.h>
 #include <GL/freeglut.h>
+#include <GL/glx.h>
 #include "../SOIL.h"
+#include "../Baked.h"
 #include <time.h>
 
 #include <stdio.h>
 #include <vector>
 #include <iostream>
 #include <cstring>
+#include <string>
 #include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <new>
+#include <cstdlib>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 using namespace std;
 
-const int WIDTH = 1400;
-const int HEIGHT = 800;
+int WIDTH = 1400;
+int HEIGHT = 800;
 int makeRand = rand() % 5;
 
-static const char* vertex_source = 
-    "   #version 130 \n" 
+typedef enum {
+    a_Position,
+    a_Color,
+    a_TexCoord,
+    a_InstanceMatrix,	//4 slots, one per column
+    a_InstanceColor = a_InstanceMatrix + 4,
+    a_Ridge,
+} attrib_id;
 
-    "   uniform vec4 u_Translation; \n"
-    " 	uniform mat4 u_ViewMatrix; \n"
-  	"	uniform mat4 u_ProjMatrix; \n"
-  	"	uniform mat4 u_ModelMatrix; \n"
+/////////////////////Heap Counter
+//Built with LAND_COUNT_ALLOCS ('make counted') every operator new in the
+//program is counted, so a benchmark can show that a hot path no longer
+//touches the heap at all. Other builds keep the library's allocator.
+atomic<long> heapAllocations(0);
 
-    "   in vec4 a_Position; \n" 
-    "   in vec4 a_Color; \n"
-    "   in vec2 a_TexCoord; \n"
-    "   out vec4 v_Color; \n"
+#ifdef LAND_COUNT_ALLOCS
+const bool heapCounted = true;
 
-    "   varying vec2 v_TexCoord;\n"
+void* operator new(size_t bytes){
+	heapAllocations.fetch_add(1, memory_order_relaxed);
+	void* p = malloc(bytes ? bytes : 1);
+	if (!p) throw bad_alloc();
+	return p;
+}
 
-    "   void main() { \n" 
-    "       gl_Position = a_Position * u_ModelMatrix * u_ViewMatrix * u_ProjMatrix;  \n" 
-    "       v_Color = a_Color; \n"
-    "       v_TexCoord = a_TexCoord;\n"
-    "   } \n";
+void* operator new[](size_t bytes){
+	return operator new(bytes);
+}
 
-//http://webstaff.itn.liu.se/~stegu/jgt2012/article.pdf
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#else
+const bool heapCounted = false;
+#endif
+
+/////////////////////Trace
+//Scoped timers: Trace t("name") times the rest of its scope. Until the land
+//is first fully shown every timer is also summed by name for the startup
+//table; with --trace FILE each one is kept as a Chrome trace event and
+//written out as JSON at exit (chrome://tracing, ui.perfetto.dev).
+//The latest traceRing events of each thread are always kept as well, so a
+//spike can be looked at after the fact: 't' or SIGUSR1 writes them to a
+//capture file.
+
+typedef chrono::steady_clock traceClock;
+const traceClock::time_point traceEpoch = traceClock::now();
+
+struct TraceEvent {
+	const char* name;
+	double start, duration;	//microseconds since launch
+	int thread;
+};
 
-static const char* fragment_source =
-    "   #version 130 \n"
-    "   in vec4 v_Color; \n"
+struct TraceTotal {
+	const char* name;
+	int count;
+	double ms;
+	double first;	//start of the first one, for ordering
+};
 
-    "	uniform sampler2D u_Sampler;\n"
-    "	varying vec2 v_TexCoord;\n"
-    "	uniform float u_Time; \n"
-
-    "   vec3 permute(vec3 x){ \n"
-    "		return mod(((x*34.0)+1.0)*x, 289.0); \n"
-    "	} \n"
-
-    "	vec3 taylorInvSqrt(vec3 r){ \n"
-    "		return 1.79284291400159 - 0.85373472095314 * r; \n"
-    "	} \n"
-
-    "   float noise(vec2 P){ \n"
-    "		const vec2 C = vec2(0.21132486540518713, 0.36602540378443859); \n"
-    "		vec2 i = floor(P + dot(P, C.yy) ); \n"
-    "		vec2 x0 = P - i + dot(i, C.xx); \n"
-    "		vec2 i1; \n"
-    "		i1.x = step( x0.y, x0.x ); \n"
-    "		i1.y = 1.0 - i1.x; \n"
-    "		vec4 x12 = x0.xyxy +  vec4( C.xx, C.xx * 2.0 - 1.0); \n"
-    "		x12.xy -= i1; \n"
-    "		i = mod(i, 289.0); \n"
-    "		vec3 p = permute( permute( i.y + vec3(0.0, i1.y, 1.0 )) + i.x + vec3(0.0, i1.x, 1.0 )); \n"
-    "		vec3 m = max(0.5 - vec3(dot(x0,x0), dot(x12.xy, x12.xy), dot(x12.zw, x12.zw)), 0.0); \n"
-    "		m = m*m; \n"
-    "		m = m*m; \n"
-    "		vec3 x = fract(p*(1.0/41.0)) * 2.0 - 1.0; \n"
-    "		vec3 gy = abs(x)-0.5; \n"
-    "		vec3 ox = floor(x + 0.5); \n"
-    "		vec3 gx = x - ox; \n"
-    "		m *= taylorInvSqrt( gx*gx + gy*gy ); \n"
-    "		vec3 g; \n"
-    "		g.x = gx.x * x0.x + gy.x * x0.y; \n"
-    "		g.yz = gx.yz * x12.xz + gy.yz * x12.yw; \n"
-    "		return 130.0 * dot(m, g); \n"
-    "	} \n"
-
-    "	float turb(float cx, float cy){ \n"
-    "		return .5 * noise(vec2(cx,cy)) + .25 * noise(vec2(2*cx,2*cy)) + .125 * noise(vec2(4*cx,4*cy)); \n"
-    "	} \n"
-
-    "   void main(){ \n"
-    "		float cx = v_TexCoord.x; \n"
-    "		float cy = v_TexCoord.y; \n"
-    "		float n = (1 + sin((cx+cy + noise( vec2(cx/4 ,cy/16) ) * .5) * 50)) * .5; \n"
-    //"		float m = (1 + sin((cx+cy + sin(u_Time*.01) * turb(cx*10,cy*5) *.1) * 50))/2; \n"
-    "		float m = (1 + sin((cx + turb(cx,cy) * .1) * 25)) * .5; \n"
-
-    "       vec4 color = texture2D(u_Sampler, v_TexCoord); \n"
-    "       gl_FragColor = v_Color * vec4(color.rgb, color.a); \n"
-    //"       gl_FragColor = vec4(color.rgb, color.a); \n"
-    //"       gl_FragColor = gl_FragColor + vec4( m,m,m, 1.0); \n"
-    "   }\n";
+//Each thread records into its own buffer; the lock is only ever contended
+//when a capture or the trace file merges them
+struct TraceBuffer {
+	mutex lock;
+	vector<TraceEvent> ring;
+	size_t ringNext = 0;	//oldest event once the ring is full
+	vector<TraceEvent> events;	//--trace
+	unordered_map<const char*, TraceTotal> totals;	//startup, by literal
+};
 
-typedef enum {
-    a_Position,
-    a_Color,
-    a_TexCoord,
-} attrib_id;
+struct TraceLog {
+	mutex lock;	//buffers and threadNames
+	vector<TraceBuffer*> buffers;	//one per thread, kept until exit
+	vector<string> threadNames;
+	atomic<bool> startup;
+	atomic<size_t> events;	//kept for --trace, across threads
+	atomic<size_t> dropped;
+	TraceLog() : startup(true), events(0), dropped(0) {}
+} traceLog;
+
+string traceFile;	//--trace; events are only kept when set
+const size_t traceLimit = 1 << 21;
+const size_t traceRing = 1 << 16;	//per thread, a few hundred frames
+atomic<int> traceThreads(0);
+thread_local int traceThread = -1;
+thread_local TraceBuffer* traceBuffer = 0;
+
+double traceNow(){
+	return chrono::duration<double, micro>(traceClock::now() - traceEpoch).count();
+}
+
+int traceThreadId(){
+	if (traceThread < 0) traceThread = traceThreads++;
+	return traceThread;
+}
+
+//A track is a thread, or the GPU
+void nameTraceTrack(int id, const string &name){
+	lock_guard<mutex> l(traceLog.lock);
+	if ((int)traceLog.threadNames.size() <= id) traceLog.threadNames.resize(id + 1);
+	traceLog.threadNames[id] = name;
+}
+
+void nameTraceThread(const string &name){
+	nameTraceTrack(traceThreadId(), name);
+}
+
+TraceBuffer &threadTraceBuffer(){
+	if (!traceBuffer){
+		traceBuffer = new TraceBuffer;
+		traceBuffer->ring.reserve(traceRing);	//recording never allocates
+		lock_guard<mutex> l(traceLog.lock);
+		traceLog.buffers.push_back(traceBuffer);
+	}
+	return *traceBuffer;
+}
+
+void traceRecord(const char* name, double start, double end, int track){
+	TraceEvent e = { name, start, end - start, track };
+	TraceBuffer &b = threadTraceBuffer();
+	bool keep = !traceFile.empty();
+	if (keep && traceLog.events++ >= traceLimit){
+		traceLog.dropped++;
+		keep = false;
+	}
+	lock_guard<mutex> l(b.lock);
+	if (b.ring.size() < traceRing){
+		b.ring.push_back(e);
+	}else{
+		b.ring[b.ringNext] = e;
+		b.ringNext = (b.ringNext + 1) % traceRing;
+	}
+	if (traceLog.startup){
+		TraceTotal &t = b.totals[name];
+		if (!t.name){
+			t.name = name;
+			t.first = start;
+		}
+		t.count++;
+		t.ms += (end - start) / 1000;
+	}
+	if (keep) b.events.push_back(e);
+}
+
+struct Trace {
+	const char* name;	//a literal: kept by pointer
+	double start;
+	bool running;
+	Trace(const char* name) : name(name), start(traceNow()), running(true) {}
+	~Trace(){ stop(); }
+	void stop(){
+		if (running) traceRecord(name, start, traceNow(), traceThreadId());
+		running = false;
+	}
+};
+
+//Times are summed across threads, so work on the workers can add up to
+//more than the wall time
+void printStartup(double firstFrame){
+	traceLog.startup = false;
+	vector<TraceTotal> totals;	//merged by name text, in first-seen order
+	{
+		lock_guard<mutex> l(traceLog.lock);
+		for (size_t k = 0; k < traceLog.buffers.size(); k++){
+			TraceBuffer &b = *traceLog.buffers[k];
+			lock_guard<mutex> bl(b.lock);
+			for (auto it = b.totals.begin(); it != b.totals.end(); ++it){
+				const TraceTotal &t = it->second;
+				size_t n = 0;
+				while (n < totals.size() && strcmp(totals[n].name, t.name) != 0) n++;
+				if (n == totals.size()){
+					totals.push_back(t);
+					continue;
+				}
+				totals[n].count += t.count;
+				totals[n].ms += t.ms;
+				totals[n].first = min(totals[n].first, t.first);
+			}
+			b.totals.clear();
+		}
+	}
+	sort(totals.begin(), totals.end(), [](const TraceTotal &a, const TraceTotal &b){ return a.first < b.first; });
+	printf("Startup: first frame at %.0f ms, land ready at %.0f ms\n", firstFrame / 1000, traceNow() / 1000);
+	for (size_t k = 0; k < totals.size(); k++){
+		const TraceTotal &t = totals[k];
+		printf("  %-16s %5d x %9.1f ms\n", t.name, t.count, t.ms);
+	}
+}
+
+bool writeTraceFile(const string &path, const vector<TraceEvent> &events, const vector<string> &tracks){
+	FILE* f = fopen(path.c_str(), "w");
+	if (!f){
+		fprintf(stderr, "Could not write %s\n", path.c_str());
+		return false;
+	}
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (size_t k = 0; k < tracks.size(); k++){
+		fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+			(int)k, tracks[k].c_str());
+	}
+	for (size_t k = 0; k < events.size(); k++){
+		const TraceEvent &e = events[k];
+		fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}",
+			k ? ",\n" : "", e.name, e.thread, e.start, e.duration);
+	}
+	fprintf(f, "\n]}\n");
+	return fclose(f) == 0;
+}
+
+//Every thread's events, or with ring set only the latest of each, in start
+//order; and the track names
+void mergeTrace(bool ring, vector<TraceEvent> &events, vector<string> &tracks){
+	lock_guard<mutex> l(traceLog.lock);
+	for (size_t k = 0; k < traceLog.buffers.size(); k++){
+		TraceBuffer &b = *traceLog.buffers[k];
+		lock_guard<mutex> bl(b.lock);
+		if (ring){
+			events.insert(events.end(), b.ring.begin() + b.ringNext, b.ring.end());
+			events.insert(events.end(), b.ring.begin(), b.ring.begin() + b.ringNext);
+		}else{
+			events.insert(events.end(), b.events.begin(), b.events.end());
+		}
+	}
+	tracks = traceLog.threadNames;
+	stable_sort(events.begin(), events.end(), [](const TraceEvent &a, const TraceEvent &b){ return a.start < b.start; });
+}
+
+//Registered with atexit when --trace is given
+void writeTrace(){
+	vector<TraceEvent> events;
+	vector<string> tracks;
+	mergeTrace(false, events, tracks);
+	if (!writeTraceFile(traceFile, events, tracks)) return;
+	printf("Wrote %d trace events to %s", (int)events.size(), traceFile.c_str());
+	if (traceLog.dropped) printf(" (%d dropped)", (int)traceLog.dropped);
+	printf("\n");
+}
+
+//Set by 't' or SIGUSR1, acted on at the end of the frame
+volatile sig_atomic_t captureRequested = 0;
+
+void requestCapture(int){
+	captureRequested = 1;
+}
+
+//Write the ring, oldest first, to land-frames-<date>-<time>.json
+void captureFrames(){
+	vector<TraceEvent> events;
+	vector<string> tracks;
+	mergeTrace(true, events, tracks);
+	char path[64];
+	time_t now = time(0);
+	strftime(path, sizeof(path), "land-frames-%Y%m%d-%H%M%S.json", localtime(&now));
+	if (!writeTraceFile(path, events, tracks)) return;
+	double span = events.empty() ? 0 : (traceNow() - events[0].start) / 1e6;
+	printf("Captured the last %.1f s (%d events) to %s\n", span, (int)events.size(), path);
+}
+
+//GL timestamp queries around draw groups, on a "GPU" track of their own.
+//Each frame's queries are read back gpuFramesInFlight frames later, when
+//asking no longer waits on the GPU; a frame whose results are still not in
+//by then is dropped.
+const int gpuZoneMax = 32;
+const int gpuFramesInFlight = 4;
+
+struct GpuFrame {
+	GLuint queries[gpuZoneMax * 2];	//begin, end per zone
+	const char* names[gpuZoneMax];
+	int count;
+};
+
+struct GpuTimer {
+	bool enabled = false;
+	GpuFrame frames[gpuFramesInFlight];
+	int current = 0;
+	double offset = 0;	//trace time minus GL time, microseconds
+	double frameMs = 0;	//first zone start to last zone end, latest frame read
+
+	int track = -1;
+} gpuTimer;
+
+void initGpuTimer(){
+	if (!GLEW_ARB_timer_query) return;
+	for (int k = 0; k < gpuFramesInFlight; k++){
+		glGenQueries( gpuZoneMax * 2, gpuTimer.frames[k].queries );
+		gpuTimer.frames[k].count = 0;
+	}
+	gpuTimer.track = traceThreads++;
+	nameTraceTrack(gpuTimer.track, "GPU");
+	gpuTimer.enabled = true;
+}
+
+//Start of a frame: collect the oldest frame's zones and reuse its queries
+void beginGpuFrame(){
+	if (!gpuTimer.enabled) return;
+	gpuTimer.current = (gpuTimer.current + 1) % gpuFramesInFlight;
+	GpuFrame &f = gpuTimer.frames[gpuTimer.current];
+	GLint ready = GL_TRUE;
+	for (int k = 0; k < f.count * 2 && ready; k++){
+		glGetQueryObjectiv( f.queries[k], GL_QUERY_RESULT_AVAILABLE, &ready );
+	}
+	GLuint64 first = ~(GLuint64)0, last = 0;
+	for (int k = 0; k < f.count && ready; k++){
+		GLuint64 begin, end;
+		glGetQueryObjectui64v( f.queries[k*2], GL_QUERY_RESULT, &begin );
+		glGetQueryObjectui64v( f.queries[k*2+1], GL_QUERY_RESULT, &end );
+		traceRecord(f.names[k], begin / 1000.0 + gpuTimer.offset, end / 1000.0 + gpuTimer.offset, gpuTimer.track);
+		first = min(first, begin);
+		last = max(last, end);
+	}
+	if (ready && f.count > 0) gpuTimer.frameMs = (last - first) / 1e6;
+	f.count = 0;
+
+	GLint64 now;
+	glGetInteger64v( GL_TIMESTAMP, &now );
+	gpuTimer.offset = traceNow() - now / 1000.0;
+}
+
+struct GpuTrace {
+	int zone;
+	GpuTrace(const char* name) : zone(-1) {
+		if (!gpuTimer.enabled) return;
+		GpuFrame &f = gpuTimer.frames[gpuTimer.current];
+		if (f.count >= gpuZoneMax) return;
+		zone = f.count++;
+		f.names[zone] = name;
+		glQueryCounter( f.queries[zone*2], GL_TIMESTAMP );
+	}
+	~GpuTrace(){
+		if (zone >= 0) glQueryCounter( gpuTimer.frames[gpuTimer.current].queries[zone*2+1], GL_TIMESTAMP );
+	}
+};
+
+/////////////////////Debug Output
+//KHR_debug (the context is created with GLUT_DEBUG). Driver messages are
+//counted by source, type and id: the first of each kind is printed when it
+//arrives, notifications excepted, and the counts at exit. GL objects get
+//labels and each render phase a debug group, so the messages and tools like
+//apitrace or RenderDoc can name them.
+
+struct DebugMessage {
+	GLenum source, type, severity;
+	GLuint id;
+	int count;
+	string text;
+};
+
+struct DebugOutput {
+	bool enabled = false;
+	mutex lock;	//not synchronous: messages may come from driver threads
+	vector<DebugMessage> messages;
+	unordered_map<uint64_t, size_t> seen;	//source, type and id: index in messages
+} debugOutput;
+
+const char* debugSourceName(GLenum source){
+	switch (source){
+	case GL_DEBUG_SOURCE_API: return "api";
+	case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window system";
+	case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+	case GL_DEBUG_SOURCE_THIRD_PARTY: return "third party";
+	case GL_DEBUG_SOURCE_APPLICATION: return "application";
+	default: return "other";
+	}
+}
+
+const char* debugTypeName(GLenum type){
+	switch (type){
+	case GL_DEBUG_TYPE_ERROR: return "error";
+	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined behavior";
+	case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+	case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+	case GL_DEBUG_TYPE_MARKER: return "marker";
+	default: return "other";
+	}
+}
+
+void APIENTRY onDebugMessage(GLenum source, GLenum type, GLuint id, GLenum severity,
+		GLsizei length, const GLchar* message, const void* /*user*/){
+	lock_guard<mutex> l(debugOutput.lock);
+	vector<DebugMessage> &m = debugOutput.messages;
+	uint64_t key = (uint64_t)(source & 0xffff) << 48 | (uint64_t)(type & 0xffff) << 32 | id;
+	unordered_map<uint64_t, size_t>::iterator it = debugOutput.seen.find(key);
+	if (it != debugOutput.seen.end()){
+		m[it->second].count++;
+		return;
+	}
+	debugOutput.seen[key] = m.size();
+	DebugMessage d = { source, type, severity, id, 1, string(message, length >= 0 ? length : strlen(message)) };
+	m.push_back(d);
+	if (severity != GL_DEBUG_SEVERITY_NOTIFICATION){
+		fprintf(stderr, "GL %s %s #%u: %s\n", debugSourceName(source), debugTypeName(type), id, d.text.c_str());
+	}
+}
+
+//Registered with atexit: most frequent first
+void printDebugSummary(){
+	vector<DebugMessage> m;
+	{
+		lock_guard<mutex> l(debugOutput.lock);
+		m = debugOutput.messages;
+	}
+	if (m.empty()) return;
+	sort(m.begin(), m.end(), [](const DebugMessage &a, const DebugMessage &b){ return a.count > b.count; });
+	printf("GL debug messages:\n");
+	for (size_t k = 0; k < m.size(); k++){
+		printf("  %6d x %s %s #%u: %s\n", m[k].count, debugSourceName(m[k].source),
+			debugTypeName(m[k].type), m[k].id, m[k].text.c_str());
+	}
+}
+
+void initDebugOutput(){
+	if (!GLEW_KHR_debug) return;
+	glEnable( GL_DEBUG_OUTPUT );
+	glDebugMessageCallback( onDebugMessage, 0 );
+	glDebugMessageControl( GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, 0, GL_TRUE );
+	//Our own groups would echo back as messages
+	glDebugMessageControl( GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_PUSH_GROUP, GL_DONT_CARE, 0, 0, GL_FALSE );
+	glDebugMessageControl( GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_POP_GROUP, GL_DONT_CARE, 0, 0, GL_FALSE );
+	debugOutput.enabled = true;
+	atexit(printDebugSummary);
+}
+
+//The object must have been bound (or created) once already
+void labelObject(GLenum identifier, GLuint name, const string &label){
+	if (debugOutput.enabled && name) glObjectLabel( identifier, name, -1, label.c_str() );
+}
+
+//Buffers from glGenBuffers only become objects once bound
+void labelBuffer(GLuint buffer, const string &label){
+	if (!debugOutput.enabled || !buffer) return;
+	glBindBuffer( GL_COPY_READ_BUFFER, buffer );
+	glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+	glObjectLabel( GL_BUFFER, buffer, -1, label.c_str() );
+}
+
+struct DebugGroup {
+	bool open;
+	DebugGroup(const char* name) : open(debugOutput.enabled) {
+		if (open) glPushDebugGroup( GL_DEBUG_SOURCE_APPLICATION, 0, -1, name );
+	}
+	~DebugGroup(){ pop(); }
+	void pop(){
+		if (open) glPopDebugGroup();
+		open = false;
+	}
+};
+
+/////////////////////GPU Memory
+//Every buffer and texture Land makes goes through these wrappers, which
+//record its size under a category. --gpu-budget caps the total: more land
+//and texture layers are only allocated while there is room for them, and
+//nothing already resident is dropped for it.
+
+enum { MEM_TERRAIN, MEM_PROPS, MEM_TEXTURES, MEM_STAGING, MEM_OVERLAY, MEM_CATEGORIES };
+const char* memoryCategoryNames[MEM_CATEGORIES] = { "terrain", "props", "textures", "staging", "overlay" };
+
+struct GpuAllocation {
+	int category;
+	long bytes;
+	vector<long> levels;	//textures: bytes per mip level
+	int width, height, depth;	//textures: level 0
+	int texel;	//textures: bytes per texel, 0 when compressed
+};
+
+struct GpuMemory {
+	map<GLuint, GpuAllocation> buffers, textures;
+	long bytes[MEM_CATEGORIES] = {};
+	long peak[MEM_CATEGORIES] = {};
+	long total = 0, peakTotal = 0;
+	float budgetMB = 0;	//--gpu-budget, 0: none
+	bool full = false;	//last budget check failed; warn once per time
+} gpuMemory;
+
+void accountBytes(GpuAllocation &a, long bytes){
+	gpuMemory.bytes[a.category] += bytes - a.bytes;
+	gpuMemory.total += bytes - a.bytes;
+	a.bytes = bytes;
+	gpuMemory.peak[a.category] = max(gpuMemory.peak[a.category], gpuMemory.bytes[a.category]);
+	gpuMemory.peakTotal = max(gpuMemory.peakTotal, gpuMemory.total);
+}
+
+long gpuBudget(){
+	return (long)(gpuMemory.budgetMB * 1048576);
+}
+
+//Whether bytes more fit under the budget
+bool gpuBudgetAllows(long bytes, const char* what){
+	long budget = gpuBudget();
+	if (budget <= 0 || gpuMemory.total + bytes <= budget){
+		gpuMemory.full = false;
+		return true;
+	}
+	if (!gpuMemory.full){
+		fprintf(stderr, "GPU budget of %.0f MB reached (%.1f MB in use), no more %s for now\n",
+			gpuMemory.budgetMB, gpuMemory.total / 1048576.0, what);
+	}
+	gpuMemory.full = true;
+	return false;
+}
+
+void genBuffers(int category, GLsizei n, GLuint* buffers){
+	glGenBuffers( n, buffers );
+	for (GLsizei k = 0; k < n; k++){
+		GpuAllocation a = GpuAllocation();
+		a.category = category;
+		gpuMemory.buffers[buffers[k]] = a;
+	}
+}
+
+//glBufferData for buffer, which is bound to target
+void bufferData(GLuint buffer, GLenum target, GLsizeiptr bytes, const void* data, GLenum usage){
+	glBufferData( target, bytes, data, usage );
+	map<GLuint, GpuAllocation>::iterator it = gpuMemory.buffers.find(buffer);
+	if (it != gpuMemory.buffers.end()) accountBytes(it->second, bytes);
+}
+
+void deleteBuffers(GLsizei n, const GLuint* buffers){
+	for (GLsizei k = 0; k < n; k++){
+		map<GLuint, GpuAllocation>::iterator it = gpuMemory.buffers.find(buffers[k]);
+		if (it == gpuMemory.buffers.end()) continue;
+		accountBytes(it->second, 0);
+		gpuMemory.buffers.erase(it);
+	}
+	glDeleteBuffers( n, buffers );
+}
+
+long bufferBytes(GLuint buffer){
+	map<GLuint, GpuAllocation>::iterator it = gpuMemory.buffers.find(buffer);
+	return it == gpuMemory.buffers.end() ? 0 : it->second.bytes;
+}
+
+void genTextures(int category, GLsizei n, GLuint* textures){
+	glGenTextures( n, textures );
+	for (GLsizei k = 0; k < n; k++){
+		GpuAllocation a = GpuAllocation();
+		a.category = category;
+		gpuMemory.textures[textures[k]] = a;
+	}
+}
+
+//Uncompressed formats Land uses; RGB is padded to 4 bytes by drivers
+int texelBytes(GLint internalFormat){
+	return internalFormat == GL_R8 ? 1 : 4;
+}
+
+void recordLevel(GLuint texture, int level, long bytes, int width, int height, int depth, int texel){
+	map<GLuint, GpuAllocation>::iterator it = gpuMemory.textures.find(texture);
+	if (it == gpuMemory.textures.end()) return;
+	GpuAllocation &a = it->second;
+	if ((int)a.levels.size() <= level) a.levels.resize(level + 1, 0);
+	a.levels[level] = bytes;
+	if (level == 0){
+		a.width = width;
+		a.height = height;
+		a.depth = depth;
+		a.texel = texel;
+	}
+	long sum = 0;
+	for (size_t l = 0; l < a.levels.size(); l++) sum += a.levels[l];
+	accountBytes(a, sum);
+}
+
+//glTexImage2D/3D for texture, which is bound to target
+void texImage2D(GLuint texture, GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+		GLenum format, GLenum type, const void* pixels){
+	glTexImage2D( target, level, internalFormat, width, height, 0, format, type, pixels );
+	int texel = texelBytes(internalFormat);
+	recordLevel(texture, level, (long)width * height * texel, width, height, 1, texel);
+}
+
+void texImage3D(GLuint texture, GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+		GLsizei depth, GLenum format, GLenum type, const void* pixels){
+	glTexImage3D( target, level, internalFormat, width, height, depth, 0, format, type, pixels );
+	int texel = texelBytes(internalFormat);
+	recordLevel(texture, level, (long)width * height * depth * texel, width, height, depth, texel);
+}
+
+void compressedTexImage2D(GLuint texture, GLenum target, GLint level, GLenum format, GLsizei width, GLsizei height,
+		GLsizei bytes, const void* data){
+	glCompressedTexImage2D( target, level, format, width, height, 0, bytes, data );
+	recordLevel(texture, level, bytes, width, height, 1, 0);
+}
+
+//glGenerateMipmap, counting whatever levels it had to add
+void generateMipmap(GLuint texture, GLenum target){
+	glGenerateMipmap( target );
+	map<GLuint, GpuAllocation>::iterator it = gpuMemory.textures.find(texture);
+	if (it == gpuMemory.textures.end() || it->second.levels.empty()) return;
+	GpuAllocation a = it->second;
+	int w = a.width, h = a.height;
+	for (int l = 1; w > 1 || h > 1; l++){
+		w = max(w / 2, 1);
+		h = max(h / 2, 1);
+		if (l >= (int)a.levels.size() || a.levels[l] == 0){
+			recordLevel(texture, l, (long)w * h * a.depth * a.texel, w, h, a.depth, a.texel);
+		}
+	}
+}
+
+void deleteTextures(GLsizei n, const GLuint* textures){
+	for (GLsizei k = 0; k < n; k++){
+		map<GLuint, GpuAllocation>::iterator it = gpuMemory.textures.find(textures[k]);
+		if (it == gpuMemory.textures.end()) continue;
+		accountBytes(it->second, 0);
+		gpuMemory.textures.erase(it);
+	}
+	glDeleteTextures( n, textures );
+}
+
+void printGpuMemory(){
+	printf("GPU memory: %.1f MB, peak %.1f MB", gpuMemory.total / 1048576.0, gpuMemory.peakTotal / 1048576.0);
+	if (gpuBudget() > 0) printf(" of a %.0f MB budget", gpuMemory.budgetMB);
+	printf("\n");
+	for (int c = 0; c < MEM_CATEGORIES; c++){
+		printf("  %-9s %8.1f MB, peak %8.1f MB\n", memoryCategoryNames[c],
+			gpuMemory.bytes[c] / 1048576.0, gpuMemory.peak[c] / 1048576.0);
+	}
+}
+
+/////////////////////Matrix4
+//Column-major 4x4 (same layout as cuon-matrix.js), stored 16-byte aligned so
+//each column is one SSE/NEON register. Every operation works in place on the
+//columns; there are no 16-float scratch copies.
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+typedef __m128 vec4f;
+static inline vec4f v4_load(const float* p){ return _mm_load_ps(p); }
+static inline vec4f v4_loadu(const float* p){ return _mm_loadu_ps(p); }
+static inline void v4_store(float* p, vec4f v){ _mm_store_ps(p, v); }
+static inline void v4_storeu(float* p, vec4f v){ _mm_storeu_ps(p, v); }
+static inline vec4f v4_set(float x, float y, float z, float w){ return _mm_setr_ps(x, y, z, w); }
+static inline vec4f v4_splat(float s){ return _mm_set1_ps(s); }
+static inline vec4f v4_add(vec4f a, vec4f b){ return _mm_add_ps(a, b); }
+static inline vec4f v4_mul(vec4f a, vec4f b){ return _mm_mul_ps(a, b); }
+static inline vec4f v4_sub(vec4f a, vec4f b){ return _mm_sub_ps(a, b); }
+static inline vec4f v4_rsqrt(vec4f a){ return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a)); }
+static inline void v4_transpose(vec4f &a, vec4f &b, vec4f &c, vec4f &d){ _MM_TRANSPOSE4_PS(a, b, c, d); }
+#define v4_lane(m, k) _mm_shuffle_ps((m), (m), _MM_SHUFFLE(k, k, k, k))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+typedef float32x4_t vec4f;
+static inline vec4f v4_load(const float* p){ return vld1q_f32(p); }
+static inline vec4f v4_loadu(const float* p){ return vld1q_f32(p); }
+static inline void v4_store(float* p, vec4f v){ vst1q_f32(p, v); }
+static inline void v4_storeu(float* p, vec4f v){ vst1q_f32(p, v); }
+static inline vec4f v4_set(float x, float y, float z, float w){ float t[4] = {x, y, z, w}; return vld1q_f32(t); }
+static inline vec4f v4_splat(float s){ return vdupq_n_f32(s); }
+//vmlaq may fuse; keep mul and add separate so results match the scalar path
+static inline vec4f v4_add(vec4f a, vec4f b){ return vaddq_f32(a, b); }
+static inline vec4f v4_mul(vec4f a, vec4f b){ return vmulq_f32(a, b); }
+static inline vec4f v4_sub(vec4f a, vec4f b){ return vsubq_f32(a, b); }
+static inline vec4f v4_rsqrt(vec4f a){
+	vec4f r = vrsqrteq_f32(a);
+	r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a, r), r));
+	return vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a, r), r));
+}
+static inline void v4_transpose(vec4f &a, vec4f &b, vec4f &c, vec4f &d){
+	float32x4x2_t ab = vtrnq_f32(a, b);
+	float32x4x2_t cd = vtrnq_f32(c, d);
+	a = vcombine_f32(vget_low_f32(ab.val[0]),  vget_low_f32(cd.val[0]));
+	b = vcombine_f32(vget_low_f32(ab.val[1]),  vget_low_f32(cd.val[1]));
+	c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+	d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+#define v4_lane(m, k) vdupq_n_f32(vgetq_lane_f32((m), k))
+#else
+struct vec4f { float v[4]; };
+static inline vec4f v4_load(const float* p){ vec4f r = {{p[0], p[1], p[2], p[3]}}; return r; }
+static inline vec4f v4_loadu(const float* p){ return v4_load(p); }
+static inline void v4_store(float* p, vec4f v){ p[0] = v.v[0]; p[1] = v.v[1]; p[2] = v.v[2]; p[3] = v.v[3]; }
+static inline void v4_storeu(float* p, vec4f v){ v4_store(p, v); }
+static inline vec4f v4_set(float x, float y, float z, float w){ vec4f r = {{x, y, z, w}}; return r; }
+static inline vec4f v4_splat(float s){ vec4f r = {{s, s, s, s}}; return r; }
+static inline vec4f v4_add(vec4f a, vec4f b){
+	vec4f r = {{a.v[0]+b.v[0], a.v[1]+b.v[1], a.v[2]+b.v[2], a.v[3]+b.v[3]}}; return r;
+}
+static inline vec4f v4_mul(vec4f a, vec4f b){
+	vec4f r = {{a.v[0]*b.v[0], a.v[1]*b.v[1], a.v[2]*b.v[2], a.v[3]*b.v[3]}}; return r;
+}
+static inline vec4f v4_sub(vec4f a, vec4f b){
+	vec4f r = {{a.v[0]-b.v[0], a.v[1]-b.v[1], a.v[2]-b.v[2], a.v[3]-b.v[3]}}; return r;
+}
+static inline vec4f v4_rsqrt(vec4f a){
+	vec4f r = {{1/sqrtf(a.v[0]), 1/sqrtf(a.v[1]), 1/sqrtf(a.v[2]), 1/sqrtf(a.v[3])}}; return r;
+}
+static inline void v4_transpose(vec4f &a, vec4f &b, vec4f &c, vec4f &d){
+	float t;
+	t = a.v[1]; a.v[1] = b.v[0]; b.v[0] = t;
+	t = a.v[2]; a.v[2] = c.v[0]; c.v[0] = t;
+	t = a.v[3]; a.v[3] = d.v[0]; d.v[0] = t;
+	t = b.v[2]; b.v[2] = c.v[1]; c.v[1] = t;
+	t = b.v[3]; b.v[3] = d.v[1]; d.v[1] = t;
+	t = c.v[3]; c.v[3] = d.v[2]; d.v[2] = t;
+}
+#define v4_lane(m, k) v4_splat((m).v[k])
+#endif
+
+//out = a * b. Both operands are loaded into registers before anything is
+//stored, so out may alias a or b. When b is affine (bottom row 0,0,0,1) the
+//multiplies by the known zero/one entries are skipped. Results match the
+//scalar a * b exactly (Tests/matrix.cpp) except for the sign of zeros: a sum
+//that is -0 stays -0 here, where adding a3 * +0 would have made it +0.
+static inline void mat4_mul(float* out, const float* a, const float* b){
+	vec4f a0 = v4_loadu(a), a1 = v4_loadu(a+4), a2 = v4_loadu(a+8), a3 = v4_loadu(a+12);
+	vec4f b0 = v4_loadu(b), b1 = v4_loadu(b+4), b2 = v4_loadu(b+8), b3 = v4_loadu(b+12);
+
+	if (b[3] == 0 && b[7] == 0 && b[11] == 0 && b[15] == 1){
+		vec4f r0 = v4_add(v4_add(v4_mul(a0, v4_lane(b0,0)), v4_mul(a1, v4_lane(b0,1))), v4_mul(a2, v4_lane(b0,2)));
+		vec4f r1 = v4_add(v4_add(v4_mul(a0, v4_lane(b1,0)), v4_mul(a1, v4_lane(b1,1))), v4_mul(a2, v4_lane(b1,2)));
+		vec4f r2 = v4_add(v4_add(v4_mul(a0, v4_lane(b2,0)), v4_mul(a1, v4_lane(b2,1))), v4_mul(a2, v4_lane(b2,2)));
+		vec4f r3 = v4_add(v4_add(v4_add(v4_mul(a0, v4_lane(b3,0)), v4_mul(a1, v4_lane(b3,1))), v4_mul(a2, v4_lane(b3,2))), a3);
+		v4_store(out, r0); v4_store(out+4, r1); v4_store(out+8, r2); v4_store(out+12, r3);
+		return;
+	}
+
+	vec4f r0 = v4_add(v4_add(v4_add(v4_mul(a0, v4_lane(b0,0)), v4_mul(a1, v4_lane(b0,1))), v4_mul(a2, v4_lane(b0,2))), v4_mul(a3, v4_lane(b0,3)));
+	vec4f r1 = v4_add(v4_add(v4_add(v4_mul(a0, v4_lane(b1,0)), v4_mul(a1, v4_lane(b1,1))), v4_mul(a2, v4_lane(b1,2))), v4_mul(a3, v4_lane(b1,3)));
+	vec4f r2 = v4_add(v4_add(v4_add(v4_mul(a0, v4_lane(b2,0)), v4_mul(a1, v4_lane(b2,1))), v4_mul(a2, v4_lane(b2,2))), v4_mul(a3, v4_lane(b2,3)));
+	vec4f r3 = v4_add(v4_add(v4_add(v4_mul(a0, v4_lane(b3,0)), v4_mul(a1, v4_lane(b3,1))), v4_mul(a2, v4_lane(b3,2))), v4_mul(a3, v4_lane(b3,3)));
+	v4_store(out, r0); v4_store(out+4, r1); v4_store(out+8, r2); v4_store(out+12, r3);
+}
+
+//Degrees to sin/cos, rounded to float exactly like the original setRotate
+static inline void rotationSinCos(float angle, float &s, float &c){
+	angle = M_PI * angle / 180.0;
+	s = sin(angle);
+	c = cos(angle);
+}
 
-struct Matrix4 {
+struct alignas(16) Matrix4 {
     float elements[16] = {1,0,0,0,  0,1,0,0,  0,0,1,0,  0,0,0,1};
 
-	void setElements(float (&e)[16]){
-		for (int n = 0; n < 16; n++){
-            elements[n] = e[n];
-        }
+	void setElements(const float (&e)[16]){
+		v4_store(elements,    v4_loadu(e));
+		v4_store(elements+4,  v4_loadu(e+4));
+		v4_store(elements+8,  v4_loadu(e+8));
+		v4_store(elements+12, v4_loadu(e+12));
+	}
+
+	void setColumns(vec4f c0, vec4f c1, vec4f c2, vec4f c3){
+		v4_store(elements, c0);   v4_store(elements+4, c1);
+		v4_store(elements+8, c2); v4_store(elements+12, c3);
 	}
 
     //Set default matrix
     void setIdentity(){
-        float e[16];
-        e[0] = 1;   e[4] = 0;   e[8]  = 0;   e[12] = 0;
-        e[1] = 0;   e[5] = 1;   e[9]  = 0;   e[13] = 0;
-        e[2] = 0;   e[6] = 0;   e[10] = 1;   e[14] = 0;
-        e[3] = 0;   e[7] = 0;   e[11] = 0;   e[15] = 1;
-        setElements(e);
+        setColumns(v4_set(1,0,0,0), v4_set(0,1,0,0), v4_set(0,0,1,0), v4_set(0,0,0,1));
     }
 
     //Copies Matrix to another
-    void copyFrom(Matrix4 old){
-        for(int n = 0; n < 16; n++){
-            elements[n] = old.elements[16-n];
-        }
+    void copyFrom(const Matrix4 &old){
+        setColumns(v4_load(old.elements), v4_load(old.elements+4),
+                   v4_load(old.elements+8), v4_load(old.elements+12));
+    }
+
+    //Bottom row is 0,0,0,1 (no projection)
+    bool isAffine() const {
+    	return elements[3] == 0 && elements[7] == 0 && elements[11] == 0 && elements[15] == 1;
     }
 
     //Print Matrix
@@ -145,86 +821,45 @@ struct Matrix4 {
     //Reverse matrix
 	void transpose(){
 		float t;
-		float e[16];
-		for (int n = 0; n < 16; n++){
-            e[n] = elements[n];
-        }
+		float* e = elements;
 		t = e[ 1];  e[ 1] = e[ 4];  e[ 4] = t;
 		t = e[ 2];  e[ 2] = e[ 8];  e[ 8] = t;
 		t = e[ 3];  e[ 3] = e[12];  e[12] = t;
 		t = e[ 6];  e[ 6] = e[ 9];  e[ 9] = t;
 		t = e[ 7];  e[ 7] = e[13];  e[13] = t;
 		t = e[11];  e[11] = e[14];  e[14] = t;
-		setElements(e);
 	}
 
 	//SetTranslate on Translation matrix
 	void setTranslate(float x, float y, float z) {
-		float e[16];
-		for (int n = 0; n < 16; n++){
-            e[n] = elements[n];
-        }
-		e[0] = 1;  e[4] = 0;  e[8]  = 0;  e[12] = x;
-		e[1] = 0;  e[5] = 1;  e[9]  = 0;  e[13] = y;
-		e[2] = 0;  e[6] = 0;  e[10] = 1;  e[14] = z;
-		e[3] = 0;  e[7] = 0;  e[11] = 0;  e[15] = 1;
-		setElements(e);
-		return;
+		setColumns(v4_set(1,0,0,0), v4_set(0,1,0,0), v4_set(0,0,1,0), v4_set(x,y,z,1));
 	};
 
 	//Translate matrix by x, y, z - multiply by x, y, z
 	void translate(float x, float y, float z) {
-		float e[16]; 
-  		for (int n = 0; n < 16; n++){
-            e[n] = elements[n];
-        }
-		e[12] += e[0] * x + e[4] * y + e[8]  * z;
-		e[13] += e[1] * x + e[5] * y + e[9]  * z;
-		e[14] += e[2] * x + e[6] * y + e[10] * z;
-		e[15] += e[3] * x + e[7] * y + e[11] * z;
-		setElements(e);
-		return;
+		vec4f t = v4_add(v4_add(v4_mul(v4_load(elements), v4_splat(x)),
+		                        v4_mul(v4_load(elements+4), v4_splat(y))),
+		                        v4_mul(v4_load(elements+8), v4_splat(z)));
+		v4_store(elements+12, v4_add(v4_load(elements+12), t));
 	}
 
 	//SetScale on Model matrix
 	void setScale(float x, float y, float z) {
-		float e[16];
-		for (int n = 0; n < 16; n++){
-            e[n] = elements[n];
-        }
-		e[0] = x;  e[4] = 0;  e[8]  = 0;  e[12] = 0;
-		e[1] = 0;  e[5] = y;  e[9]  = 0;  e[13] = 0;
-		e[2] = 0;  e[6] = 0;  e[10] = z;  e[14] = 0;
-		e[3] = 0;  e[7] = 0;  e[11] = 0;  e[15] = 1;
-		setElements(e);
-		return;
+		setColumns(v4_set(x,0,0,0), v4_set(0,y,0,0), v4_set(0,0,z,0), v4_set(0,0,0,1));
 	};
 
 	//Scale on Model matrix, multiply by x y z
 	void scale(float x, float y, float z) {
-		float e[16];
-		for (int n = 0; n < 16; n++){
-            e[n] = elements[n];
-        }
-		e[0] *= x;  e[4] *= y;  e[8]  *= z;
-		e[1] *= x;  e[5] *= y;  e[9]  *= z;
-		e[2] *= x;  e[6] *= y;  e[10] *= z;
-		e[3] *= x;  e[7] *= y;  e[11] *= z;
-		setElements(e);
-		return;
+		v4_store(elements,   v4_mul(v4_load(elements),   v4_splat(x)));
+		v4_store(elements+4, v4_mul(v4_load(elements+4), v4_splat(y)));
+		v4_store(elements+8, v4_mul(v4_load(elements+8), v4_splat(z)));
 	};
 
 	void setRotate( float angle, float x, float y, float z) {
 		float s, c, len, rlen, nc, xy, yz, zx, xs, ys, zs;
-		float e[16];
-		for (int n = 0; n < 16; n++){
-	        e[n] = elements[n];
-	    }
-
-		angle = M_PI * angle / 180.0;
+		float* e = elements;
 
-		s = sin(angle);
-		c = cos(angle);
+		rotationSinCos(angle, s, c);
 
 		if (0 != x && 0 == y && 0 == z) {
 	    	// Rotation around X axis
@@ -270,110 +905,82 @@ struct Matrix4 {
 			ys = y * s;
 			zs = z * s;
 
-			e[ 0] = x*x*nc +  c;
-			e[ 1] = xy *nc + zs;
-			e[ 2] = zx *nc - ys;
-			e[ 3] = 0;
-
-			e[ 4] = xy *nc - zs;
-			e[ 5] = y*y*nc +  c;
-			e[ 6] = yz *nc + xs;
-			e[ 7] = 0;
-
-			e[ 8] = zx *nc + ys;
-			e[ 9] = yz *nc - xs;
-			e[10] = z*z*nc +  c;
-			e[11] = 0;
-
-			e[12] = 0;
-			e[13] = 0;
-			e[14] = 0;
-			e[15] = 1;
+			setColumns(v4_set(x*x*nc +  c, xy *nc + zs, zx *nc - ys, 0),
+			           v4_set(xy *nc - zs, y*y*nc +  c, yz *nc + xs, 0),
+			           v4_set(zx *nc + ys, yz *nc - xs, z*z*nc +  c, 0),
+			           v4_set(0, 0, 0, 1));
 		}
-		setElements(e);
-
-		return;
 	};
 
+	//Multiply by a rotation. Axis aligned rotations only touch the two
+	//columns they mix; any other axis goes through the affine concat path.
 	void rotate( float angle, float x, float y, float z ){
-		Matrix4 temp;
-		temp.setRotate(angle, x, y, z);
-		concat( temp.elements );
-	}
-
-	void concat( float (&other)[16] ) {
-		int i;
-		float ai0, ai1, ai2, ai3;
-		float e[16];
-		float a[16];
-		float b[16];
-		// Calculate e = a * b
-		for (int n = 0; n < 16; n++){
-	        e[n] = elements[n];
-	        a[n] = elements[n];
-	        b[n] = other[n];
-	    }
-  
-		for (i = 0; i < 4; i++) {
-			ai0=a[i];  ai1=a[i+4];  ai2=a[i+8];  ai3=a[i+12];
-			e[i]    = ai0 * b[0]  + ai1 * b[1]  + ai2 * b[2]  + ai3 * b[3];
-			e[i+4]  = ai0 * b[4]  + ai1 * b[5]  + ai2 * b[6]  + ai3 * b[7];
-			e[i+8]  = ai0 * b[8]  + ai1 * b[9]  + ai2 * b[10] + ai3 * b[11];
-			e[i+12] = ai0 * b[12] + ai1 * b[13] + ai2 * b[14] + ai3 * b[15];
+		float s, c;
+		if ((0 != x) + (0 != y) + (0 != z) != 1){
+			Matrix4 temp;
+			temp.setRotate(angle, x, y, z);
+			concat(temp);
+			return;
 		}
-		setElements(e);
+		rotationSinCos(angle, s, c);
+		int i, k;
+		if (0 != x){
+			if (x < 0) s = -s;
+			i = 4; k = 8;	//Y, Z columns
+		} else if (0 != y){
+			if (y < 0) s = -s;
+			i = 8; k = 0;	//Z, X columns
+		} else {
+			if (z < 0) s = -s;
+			i = 0; k = 4;	//X, Y columns
+		}
+		vec4f ci = v4_load(elements+i);
+		vec4f ck = v4_load(elements+k);
+		v4_store(elements+i, v4_add(v4_mul(ci, v4_splat(c)), v4_mul(ck, v4_splat(s))));
+		v4_store(elements+k, v4_add(v4_mul(ci, v4_splat(-s)), v4_mul(ck, v4_splat(c))));
+	}
 
-		return;
+	void concat( const float (&other)[16] ) {
+		// Calculate e = e * other
+		mat4_mul(elements, elements, other);
 	};
 
+	void concat( const Matrix4 &other ) {
+		mat4_mul(elements, elements, other.elements);
+	};
+
+	//Set to a * b (either may be this matrix)
+	void setMultiply( const Matrix4 &a, const Matrix4 &b ){
+		mat4_mul(elements, a.elements, b.elements);
+	}
+
 	// Set Perspective for Perspective Matrix
 	void setPerspective(float fovy, float aspect, float near, float far) {
 		float rd, s, ct;
 
 		if (near == far || aspect == 0) {
-			cerr << 'null frustum' << endl;
+			cerr << "null frustum" << endl;
 		}
 		if (near <= 0) {
-			cerr << 'near <= 0' << endl;
+			cerr << "near <= 0" << endl;
 		}
 		if (far <= 0) {
-			cerr << 'far <= 0' << endl;
+			cerr << "far <= 0" << endl;
 		}
 
 		fovy = M_PI * fovy / 180.0 / 2.0;
   		s = sin(fovy);
 		if (s == 0) {
-			cerr << 'null frustum' << endl;
+			cerr << "null frustum" << endl;
 		}
 
 		rd = 1.0 / (far - near);
 		ct = cos(fovy) / s;
 
-		float e[16]; 
-  		for (int n = 0; n < 16; n++){
-            e[n] = elements[n];
-        }
-		e[0]  = ct / aspect;
-		e[1]  = 0;
-		e[2]  = 0;
-		e[3]  = 0;
-
-		e[4]  = 0;
-		e[5]  = ct;
-		e[6]  = 0;
-		e[7]  = 0;
-
-		e[8]  = 0;
-		e[9]  = 0;
-		e[10] = -(far + near) * rd;
-		e[11] = -1;
-
-		e[12] = 0;
-		e[13] = 0;
-		e[14] = -2 * near * far * rd;
-		e[15] = 0;
-		setElements(e);
-		return;
+		setColumns(v4_set(ct / aspect, 0, 0, 0),
+		           v4_set(0, ct, 0, 0),
+		           v4_set(0, 0, -(far + near) * rd, -1),
+		           v4_set(0, 0, -2 * near * far * rd, 0));
 	}
 
 	//Set Look At for Projection Matrix
@@ -409,80 +1016,386 @@ struct Matrix4 {
 		uz = sx * fy - sy * fx;
 
 		// Set to this.
-		float e[16]; 
-  		for (int n = 0; n < 16; n++){
-            e[n] = elements[n];
-        }
-		e[0] = sx;
-		e[1] = ux;
-		e[2] = -fx;
-		e[3] = 0;
-
-		e[4] = sy;
-		e[5] = uy;
-		e[6] = -fy;
-		e[7] = 0;
-
-		e[8] = sz;
-		e[9] = uz;
-		e[10] = -fz;
-		e[11] = 0;
-
-		e[12] = 0;
-		e[13] = 0;
-		e[14] = 0;
-		e[15] = 1;
-		setElements(e);
+		setColumns(v4_set(sx, ux, -fx, 0),
+		           v4_set(sy, uy, -fy, 0),
+		           v4_set(sz, uz, -fz, 0),
+		           v4_set(0, 0, 0, 1));
 		// Translate.
 		translate(-eyeX, -eyeY, -eyeZ);
-		return;
 	};
 
 };
 
-/////////////////////Simplex Noise
+/////////////////////Transforms
+//Structure-of-arrays storage for many objects: one 16-byte aligned array per
+//component so the batch passes below build four matrices per SIMD iteration.
+//Rotation is a unit quaternion; spin is an optional per-frame rotation.
 
-static int SEED;
+struct TransformSoA {
+	enum { PX, PY, PZ, QX, QY, QZ, QW, SX, SY, SZ, DX, DY, DZ, DW, STREAMS };
+	float* s[STREAMS] = {};
+	int count = 0;
+	int capacity = 0; //always a multiple of 4
 
-static int hash_noise[] = {208,34,231,213,32,248,233,56,161,78,24,140,71,48,140,254,245,255,247,247,40,
-                     185,248,251,245,28,124,204,204,76,36,1,107,28,234,163,202,224,245,128,167,204,
-                     9,92,217,54,239,174,173,102,193,189,190,121,100,108,167,44,43,77,180,204,8,81,
-                     70,223,11,38,24,254,210,210,177,32,81,195,243,125,8,169,112,32,97,53,195,13,
-                     203,9,47,104,125,117,114,124,165,203,181,235,193,206,70,180,174,0,167,181,41,
-                     164,30,116,127,198,245,146,87,224,149,206,57,4,192,210,65,210,129,240,178,105,
-                     228,108,245,148,140,40,35,195,38,58,65,207,215,253,65,85,208,76,62,3,237,55,89,
-                     232,50,217,64,244,157,199,121,252,90,17,212,203,149,152,140,187,234,177,73,174,
-                     193,100,192,143,97,53,145,135,19,103,13,90,135,151,199,91,239,247,33,39,145,
-                     101,120,99,3,186,86,99,41,237,203,111,79,220,135,158,42,30,154,120,67,87,167,
-                     135,176,183,191,253,115,184,21,233,58,129,233,142,39,128,211,118,137,139,255,
-                     114,20,218,113,154,27,127,246,250,1,8,198,250,209,92,222,173,21,88,102,219};
+	TransformSoA(){}
+	TransformSoA(const TransformSoA&) = delete;
+	TransformSoA& operator=(const TransformSoA&) = delete;
 
-int noise2(int x, int y)
-{
-    int tmp = hash_noise[(y + SEED) % 256];
-    return hash_noise[(tmp + x) % 256];
+	~TransformSoA(){
+		for (int k = 0; k < STREAMS; k++) free(s[k]);
+	}
+
+	void reserve(int n){
+		if (n <= capacity) return;
+		n = (n + 3) & ~3;
+		for (int k = 0; k < STREAMS; k++){
+			void* p = 0;
+			if (posix_memalign(&p, 16, n * sizeof(float)) != 0){
+				cerr << "TransformSoA: out of memory" << endl;
+				exit(1);
+			}
+			if (s[k]){
+				memcpy(p, s[k], capacity * sizeof(float));
+				free(s[k]);
+			}
+			s[k] = (float*)p;
+		}
+		//Padding lanes hold identity transforms so batches never see garbage
+		for (int i = capacity; i < n; i++) reset(i, 0, 0, 0);
+		capacity = n;
+	}
+
+	void reset(int i, float x, float y, float z){
+		s[PX][i] = x;  s[PY][i] = y;  s[PZ][i] = z;
+		s[QX][i] = 0;  s[QY][i] = 0;  s[QZ][i] = 0;  s[QW][i] = 1;
+		s[SX][i] = 1;  s[SY][i] = 1;  s[SZ][i] = 1;
+		s[DX][i] = 0;  s[DY][i] = 0;  s[DZ][i] = 0;  s[DW][i] = 1;
+	}
+
+	int add(float x, float y, float z){
+		if (count == capacity) reserve(capacity ? capacity * 2 : 64);
+		reset(count, x, y, z);
+		return count++;
+	}
+
+	void clear(){ count = 0; }
+
+	void setPosition(int i, float x, float y, float z){
+		s[PX][i] = x;  s[PY][i] = y;  s[PZ][i] = z;
+	}
+
+	void setScale(int i, float x, float y, float z){
+		s[SX][i] = x;  s[SY][i] = y;  s[SZ][i] = z;
+	}
+
+	//Angle in degrees around x, y, z, same convention as Matrix4::setRotate
+	static void axisAngle(float* q, float angle, float x, float y, float z){
+		float len = sqrt(x*x + y*y + z*z);
+		if (len == 0){
+			q[0] = 0; q[1] = 0; q[2] = 0; q[3] = 1;
+			return;
+		}
+		float half = M_PI * angle / 360.0;
+		float k = sin(half) / len;
+		q[0] = x * k; q[1] = y * k; q[2] = z * k; q[3] = cos(half);
+	}
+
+	void setRotate(int i, float angle, float x, float y, float z){
+		float q[4];
+		axisAngle(q, angle, x, y, z);
+		s[QX][i] = q[0];  s[QY][i] = q[1];  s[QZ][i] = q[2];  s[QW][i] = q[3];
+	}
+
+	//Rotation applied (in object space) every time spinTransforms runs
+	void setSpin(int i, float angle, float x, float y, float z){
+		float q[4];
+		axisAngle(q, angle, x, y, z);
+		s[DX][i] = q[0];  s[DY][i] = q[1];  s[DZ][i] = q[2];  s[DW][i] = q[3];
+	}
+};
+
+//q = q * spin, renormalized so the rotation does not drift over time
+void spinTransforms(TransformSoA &t){
+	float** s = t.s;
+	for (int i = 0; i < t.count; i += 4){
+		vec4f qx = v4_load(s[TransformSoA::QX]+i), qy = v4_load(s[TransformSoA::QY]+i);
+		vec4f qz = v4_load(s[TransformSoA::QZ]+i), qw = v4_load(s[TransformSoA::QW]+i);
+		vec4f dx = v4_load(s[TransformSoA::DX]+i), dy = v4_load(s[TransformSoA::DY]+i);
+		vec4f dz = v4_load(s[TransformSoA::DZ]+i), dw = v4_load(s[TransformSoA::DW]+i);
+
+		vec4f w = v4_sub(v4_sub(v4_sub(v4_mul(qw, dw), v4_mul(qx, dx)), v4_mul(qy, dy)), v4_mul(qz, dz));
+		vec4f x = v4_sub(v4_add(v4_add(v4_mul(qw, dx), v4_mul(qx, dw)), v4_mul(qy, dz)), v4_mul(qz, dy));
+		vec4f y = v4_add(v4_add(v4_sub(v4_mul(qw, dy), v4_mul(qx, dz)), v4_mul(qy, dw)), v4_mul(qz, dx));
+		vec4f z = v4_add(v4_sub(v4_add(v4_mul(qw, dz), v4_mul(qx, dy)), v4_mul(qy, dx)), v4_mul(qz, dw));
+
+		vec4f n = v4_add(v4_add(v4_mul(x, x), v4_mul(y, y)), v4_add(v4_mul(z, z), v4_mul(w, w)));
+		n = v4_rsqrt(n);
+		v4_store(s[TransformSoA::QX]+i, v4_mul(x, n));
+		v4_store(s[TransformSoA::QY]+i, v4_mul(y, n));
+		v4_store(s[TransformSoA::QZ]+i, v4_mul(z, n));
+		v4_store(s[TransformSoA::QW]+i, v4_mul(w, n));
+	}
 }
 
-float lin_inter(float x, float y, float s)
-{
-    return x + s * (y-x);
+//Rows r0..r3 of one matrix column for four objects; writes that column of
+//each object's matrix (only the first n objects of a partial batch).
+static inline void storeColumn(float* out, int i, int n, int col,
+                               vec4f r0, vec4f r1, vec4f r2, vec4f r3){
+	v4_transpose(r0, r1, r2, r3);
+	float* p = out + i * 16 + col * 4;
+	v4_storeu(p, r0);
+	if (n > 1) v4_storeu(p + 16, r1);
+	if (n > 2) v4_storeu(p + 32, r2);
+	if (n > 3) v4_storeu(p + 48, r3);
 }
 
-float smooth_inter(float x, float y, float s)
-{
-    return lin_inter(x, y, s * s * (3-2*s));
+//Column col of viewProj * world, given that column of world as x, y, z. The
+//bottom row of world is 0,0,0,1: three terms per entry, plus the viewProj
+//translation column for the last column. Written out rather than looped so
+//nothing round-trips through the stack.
+static inline void mvpColumn(float* out, int i, int n, int col, const vec4f* vp, vec4f x, vec4f y, vec4f z){
+	vec4f r0 = v4_add(v4_add(v4_mul(vp[0], x), v4_mul(vp[4], y)), v4_mul(vp[8], z));
+	vec4f r1 = v4_add(v4_add(v4_mul(vp[1], x), v4_mul(vp[5], y)), v4_mul(vp[9], z));
+	vec4f r2 = v4_add(v4_add(v4_mul(vp[2], x), v4_mul(vp[6], y)), v4_mul(vp[10], z));
+	vec4f r3 = v4_add(v4_add(v4_mul(vp[3], x), v4_mul(vp[7], y)), v4_mul(vp[11], z));
+	if (col == 3){
+		r0 = v4_add(r0, vp[12]);
+		r1 = v4_add(r1, vp[13]);
+		r2 = v4_add(r2, vp[14]);
+		r3 = v4_add(r3, vp[15]);
+	}
+	storeColumn(out, i, n, col, r0, r1, r2, r3);
 }
 
-float noise2d(float x, float y)
-{
-    int x_int = x;
-    int y_int = y;
-    float x_frac = x - x_int;
-    float y_frac = y - y_int;
-    int s = noise2(x_int, y_int);
-    int t = noise2(x_int+1, y_int);
-    int u = noise2(x_int, y_int+1);
-    int v = noise2(x_int+1, y_int+1);
+//World matrices (T * R * S) for every object into world, and viewProj * world
+//into mvp when both are given. Either output may be null: objects that only
+//need their MVP pass no world and skip its stores. Outputs are 16 floats per
+//object in the same column-major layout as Matrix4, so they can be written
+//straight into a mapped instance buffer.
+void updateTransforms(const TransformSoA &t, float* world, const Matrix4* viewProj = 0, float* mvp = 0){
+	float* const* s = t.s;
+	vec4f zero = v4_splat(0), one = v4_splat(1), two = v4_splat(2);
+	vec4f vp[16];
+	if (!viewProj) mvp = 0;
+	if (mvp) for (int k = 0; k < 16; k++) vp[k] = v4_splat(viewProj->elements[k]);
+
+	for (int i = 0; i < t.count; i += 4){
+		int n = t.count - i < 4 ? t.count - i : 4;
+		vec4f qx = v4_load(s[TransformSoA::QX]+i), qy = v4_load(s[TransformSoA::QY]+i);
+		vec4f qz = v4_load(s[TransformSoA::QZ]+i), qw = v4_load(s[TransformSoA::QW]+i);
+		vec4f sx = v4_load(s[TransformSoA::SX]+i), sy = v4_load(s[TransformSoA::SY]+i);
+		vec4f sz = v4_load(s[TransformSoA::SZ]+i);
+		vec4f px = v4_load(s[TransformSoA::PX]+i), py = v4_load(s[TransformSoA::PY]+i);
+		vec4f pz = v4_load(s[TransformSoA::PZ]+i);
+
+		vec4f xx = v4_mul(qx, qx), yy = v4_mul(qy, qy), zz = v4_mul(qz, qz);
+		vec4f xy = v4_mul(qx, qy), xz = v4_mul(qx, qz), yz = v4_mul(qy, qz);
+		vec4f wx = v4_mul(qw, qx), wy = v4_mul(qw, qy), wz = v4_mul(qw, qz);
+
+		//m[row][col] of the upper 3x3, columns pre-multiplied by scale
+		vec4f m00 = v4_mul(v4_sub(one, v4_mul(two, v4_add(yy, zz))), sx);
+		vec4f m10 = v4_mul(v4_mul(two, v4_add(xy, wz)), sx);
+		vec4f m20 = v4_mul(v4_mul(two, v4_sub(xz, wy)), sx);
+		vec4f m01 = v4_mul(v4_mul(two, v4_sub(xy, wz)), sy);
+		vec4f m11 = v4_mul(v4_sub(one, v4_mul(two, v4_add(xx, zz))), sy);
+		vec4f m21 = v4_mul(v4_mul(two, v4_add(yz, wx)), sy);
+		vec4f m02 = v4_mul(v4_mul(two, v4_add(xz, wy)), sz);
+		vec4f m12 = v4_mul(v4_mul(two, v4_sub(yz, wx)), sz);
+		vec4f m22 = v4_mul(v4_sub(one, v4_mul(two, v4_add(xx, yy))), sz);
+
+		if (world){
+			storeColumn(world, i, n, 0, m00, m10, m20, zero);
+			storeColumn(world, i, n, 1, m01, m11, m21, zero);
+			storeColumn(world, i, n, 2, m02, m12, m22, zero);
+			storeColumn(world, i, n, 3, px, py, pz, one);
+		}
+		if (mvp){
+			mvpColumn(mvp, i, n, 0, vp, m00, m10, m20);
+			mvpColumn(mvp, i, n, 1, vp, m01, m11, m21);
+			mvpColumn(mvp, i, n, 2, vp, m02, m12, m22);
+			mvpColumn(mvp, i, n, 3, vp, px, py, pz);
+		}
+	}
+}
+
+//CPU cost of animating n spinning cubes, against the 1 ms frame target:
+//spin, then the world matrices renderProps writes, world and MVP together,
+//and MVP alone for objects that need no world matrix. Each is the median of
+//100 frames, so a stray descheduling does not decide it. Output goes to an
+//anonymous mapping the size of an instance buffer rather than a vector;
+//without a context there is no GL mapping.
+void benchTransforms(int n){
+	TransformSoA t;
+	t.reserve(n);
+	for (int i = 0; i < n; i++){
+		int k = t.add((i % 316) * 2.0, 0, (i / 316) * 2.0);
+		t.setRotate(k, i, 1*sin(i*.01), 1, 0);
+		t.setSpin(k, 1, 1*sin(i*.01), 1, 0);
+	}
+	size_t bytes = (size_t)n * 16 * sizeof(float);
+	void* mapped = mmap(0, bytes * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED){
+		perror("mmap");
+		return;
+	}
+	float* world = (float*)mapped;
+	float* mvp = world + (size_t)n * 16;
+
+	Matrix4 viewProj, view;
+	viewProj.setPerspective(30, (float)WIDTH / HEIGHT, .1, 1450);
+	view.setLookAt(0, 10, -20, 0, 0, 100, 0, 1, 0);
+	viewProj.concat(view);
+
+	const int cases = 4, frames = 100;
+	const char* names[cases] = { "spin", "world", "world+MVP", "MVP only" };
+	vector<double> ms[cases];
+	for (int f = 0; f < frames; f++){
+		for (int c = 0; c < cases; c++){
+			auto start = chrono::steady_clock::now();
+			switch (c){
+			case 0: spinTransforms(t); break;
+			case 1: updateTransforms(t, world); break;
+			case 2: updateTransforms(t, world, &viewProj, mvp); break;
+			case 3: updateTransforms(t, 0, &viewProj, mvp); break;
+			}
+			ms[c].push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+		}
+	}
+	munmap(mapped, bytes * 2);
+	double median[cases];
+	printf("%d objects, ms/frame:", n);
+	for (int c = 0; c < cases; c++){
+		nth_element(ms[c].begin(), ms[c].begin() + frames / 2, ms[c].end());
+		median[c] = ms[c][frames / 2];
+		printf("%s %s %.3f", c ? "," : "", names[c], median[c]);
+	}
+	double props = median[0] + median[1], both = median[0] + median[2], alone = median[0] + median[3];
+	printf("\nspin + world (props today): %.3f ms, spin + world+MVP: %.3f ms, spin + MVP only: %.3f ms\n",
+		props, both, alone);
+	printf("target 1 ms: spin + world %s, spin + MVP only %s\n",
+		props < 1 ? "met" : "missed", alone < 1 ? "met" : "missed");
+}
+
+/////////////////////Scene Graph
+//Nodes live in one array with every parent before its children, so a single
+//forward pass updates the hierarchy. World matrices are only rebuilt for
+//nodes whose local matrix was edited or whose parent was rebuilt this pass;
+//static content costs one flag check per frame.
+
+struct SceneNode {
+	int parent = -1;
+	bool used = true;
+	bool dirty = true;	//local edited since last update
+	bool moved = false;	//world rebuilt by the last update
+	Matrix4 local;
+	Matrix4 world;
+};
+
+struct SceneGraph {
+	vector<SceneNode> nodes;
+	vector<int> freeNodes;
+	int rebuilt = 0;	//world matrices rebuilt by the last update
+
+	int add(int parent = -1){
+		if (parent >= (int)nodes.size()){
+			cerr << "SceneGraph: parent must be added before child" << endl;
+			parent = -1;
+		}
+		SceneNode n;
+		n.parent = parent;
+		//Reuse a released slot if it still sorts after the parent
+		for (size_t k = 0; k < freeNodes.size(); k++){
+			int i = freeNodes[k];
+			if (i > parent){
+				freeNodes.erase(freeNodes.begin() + k);
+				nodes[i] = n;
+				return i;
+			}
+		}
+		nodes.push_back(n);
+		return nodes.size() - 1;
+	}
+
+	//Leaf nodes only; the slot is recycled by a later add
+	void release(int i){
+		nodes[i].used = false;
+		nodes[i].parent = -1;
+		nodes[i].moved = false;
+		freeNodes.push_back(i);
+	}
+
+	//Local matrix for writing; marks the node and its subtree for rebuild
+	Matrix4& edit(int i){
+		nodes[i].dirty = true;
+		return nodes[i].local;
+	}
+
+	const Matrix4& world(int i) const {
+		return nodes[i].world;
+	}
+
+	void update(){
+		rebuilt = 0;
+		for (size_t i = 0; i < nodes.size(); i++){
+			SceneNode &n = nodes[i];
+			if (!n.used) continue;
+			n.moved = n.dirty || (n.parent >= 0 && nodes[n.parent].moved);
+			if (!n.moved) continue;
+			if (n.parent >= 0){
+				n.world.setMultiply(nodes[n.parent].world, n.local);
+			}else{
+				n.world.copyFrom(n.local);
+			}
+			n.dirty = false;
+			rebuilt++;
+		}
+	}
+};
+
+/////////////////////Simplex Noise
+
+static int SEED;
+
+static int hash_noise[] = {208,34,231,213,32,248,233,56,161,78,24,140,71,48,140,254,245,255,247,247,40,
+                     185,248,251,245,28,124,204,204,76,36,1,107,28,234,163,202,224,245,128,167,204,
+                     9,92,217,54,239,174,173,102,193,189,190,121,100,108,167,44,43,77,180,204,8,81,
+                     70,223,11,38,24,254,210,210,177,32,81,195,243,125,8,169,112,32,97,53,195,13,
+                     203,9,47,104,125,117,114,124,165,203,181,235,193,206,70,180,174,0,167,181,41,
+                     164,30,116,127,198,245,146,87,224,149,206,57,4,192,210,65,210,129,240,178,105,
+                     228,108,245,148,140,40,35,195,38,58,65,207,215,253,65,85,208,76,62,3,237,55,89,
+                     232,50,217,64,244,157,199,121,252,90,17,212,203,149,152,140,187,234,177,73,174,
+                     193,100,192,143,97,53,145,135,19,103,13,90,135,151,199,91,239,247,33,39,145,
+                     101,120,99,3,186,86,99,41,237,203,111,79,220,135,158,42,30,154,120,67,87,167,
+                     135,176,183,191,253,115,184,21,233,58,129,233,142,39,128,211,118,137,139,255,
+                     114,20,218,113,154,27,127,246,250,1,8,198,250,209,92,222,173,21,88,102,219};
+
+//& 255 rather than % 256 so chunks at negative coordinates stay in the table
+int noise2(int x, int y)
+{
+    int tmp = hash_noise[(y + SEED) & 255];
+    return hash_noise[(tmp + x) & 255];
+}
+
+float lin_inter(float x, float y, float s)
+{
+    return x + s * (y-x);
+}
+
+float smooth_inter(float x, float y, float s)
+{
+    return lin_inter(x, y, s * s * (3-2*s));
+}
+
+float noise2d(float x, float y)
+{
+    int x_int = floor(x);
+    int y_int = floor(y);
+    float x_frac = x - x_int;
+    float y_frac = y - y_int;
+    int s = noise2(x_int, y_int);
+    int t = noise2(x_int+1, y_int);
+    int u = noise2(x_int, y_int+1);
+    int v = noise2(x_int+1, y_int+1);
     float low = smooth_inter(s, t, x_frac);
     float high = smooth_inter(u, v, x_frac);
     return smooth_inter(low, high, y_frac);
@@ -525,6 +1438,50 @@ float turb(float cx, float cy, float f, int d){
 		 .125 * perlin2d(4*cx,4*cy,f,d);
 }
 
+///////////////////////Land Height
+
+int ls = 216;	//land size, quads per chunk side; fixed once workers start
+
+//Height terms at land grid point (X, Y), where X and Y count quads from the
+//noise origin (chunk_x * ls + x). The surface height is h * H; h alone is the
+//ridge factor that sharpens the colors toward the peaks.
+void landSample(float X, float Y, float &h, float &H){
+	float z = sqrt( (X-ls)*(X-ls)+(Y-ls)*(Y-ls)) / (128.0) * 2.5;
+	if (z > 4){ z = 4; }
+	//Fine Ridges                  //.025 default
+	h = ridgenoise( Y*.025, X*.025,  1, 1);
+	if (h >= .9) h = .9;
+	//Rolling Mountains (height of ridges across an area)
+	                           //.015 default
+	H = perlin2d( Y*.015, X*.015, .5, 1)+1;
+	h = pow(h, 2);
+	H = pow(H, z*2);
+	if (z < .5){
+		h*=(z*2);
+	}
+}
+
+//Height of the triangulated land mesh at a fractional grid point, matching
+//the two triangles initLand emits per quad (split along v0-v2)
+float landSurface(float X, float Y, float* ridge = 0){
+	float x0 = floor(X), y0 = floor(Y);
+	float fx = X - x0, fy = Y - y0;
+	float h[4], H[4], e[4];
+	for (int it = 0; it < 4; it++){
+		landSample(x0 + it/2, y0 + it%2, h[it], H[it]);
+		e[it] = h[it]*H[it];
+	}
+	//corners: 0 = (0,0) v2, 1 = (0,1) v1, 2 = (1,0) v3, 3 = (1,1) v0
+	float w0, w1, w2, w3;
+	if (fy >= fx){
+		w0 = 1 - fy;  w1 = fy - fx;  w2 = 0;  w3 = fx;
+	}else{
+		w0 = 1 - fx;  w1 = 0;  w2 = fx - fy;  w3 = fy;
+	}
+	if (ridge) *ridge = w0*h[0] + w1*h[1] + w2*h[2] + w3*h[3];
+	return w0*e[0] + w1*e[1] + w2*e[2] + w3*e[3];
+}
+
 ///////////////////////Structs
 
 GLuint vao;
@@ -535,11 +1492,17 @@ struct uniformStruct {
     GLuint ProjMatrix;
     GLuint ModelMatrix;
     GLuint Sampler;
+    GLuint Layer;
+    GLuint Base;
+    GLuint RidgeTint;
+    GLuint Paletted;
     GLfloat Time;
     float Tx = 0.0;
     float Ty = 0.0;
     float Tz = 0.0;
-} u;
+} u, ui; //ui: instanced program
+
+GLuint program, instanceProgram;
 
 
 struct Primitives {
@@ -547,13 +1510,13 @@ struct Primitives {
     GLuint colorBuffer;
     GLuint indexBuffer;
     GLuint texCoordBuffer;
-    GLuint textureID;
+    int texture; //slot in the texture cache
     int numIndices;
+    int colorSize; //4: RGBA per vertex, 1: land ridge factor for the palette
 };
 
 Primitives oneCube;
 Primitives onePlane;
-Primitives oneLand, twoLand, threeLand, fourLand;
 
 struct moveMent {
 	float px = 0; //Player Position
@@ -580,6 +1543,235 @@ struct colorPack {
 	float j;
 } world;
 
+/////////////////////File Watch
+//inotify on the directories of watched files, since editors usually save by
+//renaming a new file over the old one. Changes are picked up once per frame.
+
+struct FileWatch {
+	int wd;
+	string name;
+	function<void()> changed;
+	bool pending;	//raised an event this poll
+};
+
+int watchFd = -1;
+vector<FileWatch> fileWatches;
+
+void watchFile(const string &path, function<void()> changed){
+#ifdef __linux__
+	if (watchFd < 0) watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watchFd < 0) return;
+	size_t slash = path.find_last_of('/');
+	string dir = slash == string::npos ? "." : path.substr(0, slash + 1);
+	string name = slash == string::npos ? path : path.substr(slash + 1);
+	//Files in the same directory share its watch descriptor
+	int wd = inotify_add_watch(watchFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0) return;
+	FileWatch w = { wd, name, changed, false };
+	fileWatches.push_back(w);
+#endif
+}
+
+//Once per frame: call back every watched file that changed, once however
+//many events it raised. Nothing is allocated unless a file did change.
+void pollWatches(){
+#ifdef __linux__
+	if (watchFd < 0) return;
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool any = false;
+	ssize_t n;
+	while ((n = read(watchFd, buffer, sizeof(buffer))) > 0){
+		for (char* p = buffer; p < buffer + n; ){
+			struct inotify_event* e = (struct inotify_event*)p;
+			for (size_t k = 0; k < fileWatches.size() && e->len; k++){
+				if (fileWatches[k].wd == e->wd && fileWatches[k].name == e->name){
+					fileWatches[k].pending = true;
+					any = true;
+				}
+			}
+			p += sizeof(struct inotify_event) + e->len;
+		}
+	}
+	if (!any) return;
+	//A callback may watch more files, which can move fileWatches: call copies
+	vector< function<void()> > calls;
+	for (size_t k = 0; k < fileWatches.size(); k++){
+		if (!fileWatches[k].pending) continue;
+		fileWatches[k].pending = false;
+		calls.push_back(fileWatches[k].changed);
+	}
+	for (size_t k = 0; k < calls.size(); k++){
+		calls[k]();
+	}
+#endif
+}
+
+/////////////////////Palette
+//Land stores only its ridge factor per vertex; the shaders turn it into a
+//color with u_Base - ridge * u_RidgeTint. Switching presets is a few
+//uniforms per frame and never touches a vertex buffer.
+//
+//Presets come from presets.txt (see the comments there) and are reloaded
+//whenever that file changes.
+
+struct Preset {
+	string name;
+	float lo[6], hi[6];	//red gre blu q w j; equal unless a range
+	bool hasSky;
+	float sky[3];
+};
+
+vector<Preset> presets;
+string presetsFile = "presets.txt";
+
+//One "lo..hi" or plain number
+bool parseRange(const char* token, float &lo, float &hi){
+	const char* dots = strstr(token, "..");
+	string first(token, dots ? dots : token + strlen(token));
+	char* end;
+	lo = hi = strtof(first.c_str(), &end);
+	if (first.empty() || *end) return false;
+	if (dots){
+		hi = strtof(dots + 2, &end);
+		if (!dots[2] || *end) return false;
+	}
+	return true;
+}
+
+//Parse file into out. On error prints file:line and leaves out untouched.
+bool loadPresets(const string &file, vector<Preset> &out){
+	FILE* f = fopen(file.c_str(), "r");
+	if (!f){
+		cerr << "Could not open " << file << endl;
+		return false;
+	}
+	vector<Preset> list;
+	char line[512];
+	int number = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), f)){
+		number++;
+		char* hash = strchr(line, '#');
+		if (hash) *hash = 0;
+		char* colon = strchr(line, ':');
+		if (!colon){
+			ok = strspn(line, " \t\r\n") == strlen(line); //blank
+			continue;
+		}
+		*colon = 0;
+
+		Preset p;
+		p.name = line;
+		p.name.erase(0, p.name.find_first_not_of(" \t"));
+		p.name.erase(p.name.find_last_not_of(" \t") + 1);
+		p.hasSky = false;
+
+		vector<char*> tokens;
+		for (char* t = strtok(colon + 1, " \t\r\n"); t; t = strtok(0, " \t\r\n")){
+			tokens.push_back(t);
+		}
+		ok = tokens.size() == 6 || (tokens.size() == 10 && strcmp(tokens[6], "sky") == 0);
+		for (int k = 0; k < 6 && ok; k++){
+			ok = parseRange(tokens[k], p.lo[k], p.hi[k]);
+		}
+		if (ok && tokens.size() == 10){
+			p.hasSky = true;
+			for (int k = 0; k < 3 && ok; k++){
+				float hi;
+				ok = parseRange(tokens[7+k], p.sky[k], hi);
+			}
+		}
+		if (ok) list.push_back(p);
+	}
+	fclose(f);
+	if (!ok){
+		cerr << file << ":" << number << ": expected 'name: red gre blu q w j [sky r g b]'" << endl;
+		return false;
+	}
+	if (list.empty()){
+		cerr << file << ": no presets" << endl;
+		return false;
+	}
+	out.swap(list);
+	return true;
+}
+
+//Index of the preset named or numbered by s, or -1
+int findPreset(const char* s){
+	char* end;
+	long n = strtol(s, &end, 10);
+	if (*s && *end == 0) return n >= 0 && n < (long)presets.size() ? n : -1;
+	for (size_t k = 0; k < presets.size(); k++){
+		if (strcasecmp(presets[k].name.c_str(), s) == 0) return k;
+	}
+	return -1;
+}
+
+//World colors of preset n, rolling any ranges
+colorPack presetColors(int n){
+	colorPack c;
+	float* v = &c.red;
+	for (int k = 0; k < 6; k++){
+		const Preset &p = presets[n];
+		v[k] = p.lo[k] + (p.hi[k] - p.lo[k]) * (rand() / (float)RAND_MAX);
+	}
+	return c;
+}
+
+int preset = 0;
+colorPack paletteFrom, paletteTo;
+float skyFrom[3], skyTo[3], sky[3];
+float paletteBlend = 1;	//0 -> 1 across a switch
+const float paletteFrames = 45;
+
+//Switch to preset n, fading over paletteFrames unless blend is false
+void selectPreset(int n, bool blend){
+	preset = n;
+	printf("%s\n", presets[n].name.c_str());
+	paletteFrom = world;
+	paletteTo = presetColors(n);
+	memcpy(skyFrom, sky, sizeof(sky));
+	if (presets[n].hasSky){
+		memcpy(skyTo, presets[n].sky, sizeof(skyTo));
+	}else{
+		skyTo[0] = paletteTo.red; skyTo[1] = paletteTo.gre; skyTo[2] = paletteTo.blu;
+	}
+	paletteBlend = blend ? 0 : 1;
+	if (!blend){
+		world = paletteTo;
+		memcpy(sky, skyTo, sizeof(sky));
+		glClearColor(sky[0], sky[1], sky[2], 1.0);
+	}
+}
+
+//presets.txt changed: reapply the current preset from the new file
+void reloadPresets(){
+	if (loadPresets(presetsFile, presets)){
+		selectPreset(min(preset, (int)presets.size() - 1), true);
+	}
+}
+
+//Once per frame: step any fade in progress
+void updatePalette(){
+	if (paletteBlend >= 1) return;
+	paletteBlend = min(1.0f, paletteBlend + 1 / paletteFrames);
+	float t = paletteBlend * paletteBlend * (3 - 2 * paletteBlend);
+	const float* a = &paletteFrom.red;
+	const float* b = &paletteTo.red;
+	float* c = &world.red;
+	for (int k = 0; k < 6; k++) c[k] = a[k] + (b[k] - a[k]) * t;
+	for (int k = 0; k < 3; k++) sky[k] = skyFrom[k] + (skyTo[k] - skyFrom[k]) * t;
+	glClearColor(sky[0], sky[1], sky[2], 1.0);
+}
+
+void uploadPalette(const uniformStruct &to){
+	glUniform3f( to.Base, world.red, world.gre, world.blu);
+	glUniform3f( to.RidgeTint, world.q, world.w, world.j);
+}
+
+void cycleTerrainFeatures(); //Shader Variants
+void toggleHud(); //HUD
+
 void NormalKeyHandler(unsigned char key, int x, int y){
 	if (key == 32 && user.jumping == 0){ //Space
 		user.jumping = 1;
@@ -592,6 +1784,18 @@ void NormalKeyHandler(unsigned char key, int x, int y){
 	if (key == 122){
 		exit(0);
 	}
+	if (key == 'e'){ //next land shader variant
+		cycleTerrainFeatures();
+	}
+	if (key == 'p'){ //next color preset
+		selectPreset((preset + 1) % presets.size(), true);
+	}
+	if (key == 'h'){ //performance overlay
+		toggleHud();
+	}
+	if (key == 't'){ //write out the last few hundred frames
+		requestCapture(0);
+	}
 }
 
 void SpecialKeyUpHandler(int key, int x, int y){
@@ -632,7 +1836,6 @@ void smoothNavigate(){
 
 	//Hit Detection
 	if (user.jumping == 1 || user.moveRight == 1 || user.moveLeft == 1 || user.moveUp == 1 || user.moveDown == 1){
-		int ls = 216; //land size
 		float cx = 0.0 + ls;
 		float cy = 0.0 + ls;
 		float x = user.px * .21;
@@ -642,19 +1845,7 @@ void smoothNavigate(){
 		for (int it = 0; it < 4; it++){
 			int iy = it % 2;
 			int ix = floor(it/2);
-			float temp_x = (x+ix+cx-ls);
-			float temp_y = (y+iy+cy-ls);
-			float z = sqrt( temp_x * temp_x + temp_y * temp_y) / (128.0) * 2.5;
-			if (z > 4){ z = 4; }
-			//Fine Ridges
-			h[it] = ridgenoise( (y+iy+cy)*.025, (x+ix+cx)*.025,  1, 1);
-			if (h[it] >= .9) h[it] = h[it] = .9;
-			//Rolling Mountains (height of ridges across an area)
-			H[it] = perlin2d( (y+iy+cy)*.015, (x+ix+cx)*.015, .5, 1)+1;
-			h[it] = pow(h[it], 2);
-			H[it] = pow(H[it], z*2);
-			if (z < .5) h[it]*=(z*2);
-			
+			landSample(x+ix+cx, y+iy+cy, h[it], H[it]);
 		}
 
 		for (int it = 0; it < 4; it++){
@@ -680,466 +1871,2830 @@ void smoothNavigate(){
 }
 
 
-GLuint initShader( GLenum type, const char* source ){
-
-    GLuint shader;
-    shader = glCreateShader( type );
-
-    ///Compile Vertex shader
-    GLint status;
+//Queue a compile; the status is only asked for in shaderCompiled
+GLuint startShader( GLenum type, const char* source ){
+    GLuint shader = glCreateShader( type );
     int length = strlen( source );
     glShaderSource( shader, 1, ( const GLchar ** )&source, &length );
     glCompileShader( shader );
+    return shader;
+}
+
+bool shaderCompiled( GLuint shader, const char* kind ){
+    GLint status;
     glGetShaderiv( shader, GL_COMPILE_STATUS, &status );
 
     if( status == GL_FALSE )
     {
-        fprintf( stderr, "Fragment shader compilation failed.\n" );
+        fprintf( stderr, "%s shader compilation failed.\n", kind );
 
         GLint maxLength = 0;
         glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
 
         // The maxLength includes the NULL character
-        std::vector<GLchar> errorLog(maxLength);
+        std::vector<GLchar> errorLog(maxLength + 1);
         glGetShaderInfoLog(shader,  maxLength, &maxLength, &errorLog[0]);
+        cerr << &errorLog[0] << endl;
+        return false;
+    }
+    return true;
+}
 
-        for(int n = 0; n < maxLength; n++){
-            cerr << errorLog[n];
-        }
-        cerr << endl;
-
-        glDeleteShader( shader ); // Don't leak the shader.
-        return -1;
-    }   
-    return shader;
+//FNV-1a, 64 bit
+uint64_t fnv1a(const void* data, size_t bytes, uint64_t h = 14695981039346656037ull){
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t n = 0; n < bytes; n++){
+		h = (h ^ p[n]) * 1099511628211ull;
+	}
+	return h;
 }
 
-//https://www.opengl.org/archives/resources/code/samples/glut_examples/examples/examples.html
+struct AttributeName {
+	int id;
+	const char* name;
+};
 
-//float red;
-//float gre;
-//float blu;
+//Fixed locations shared by every program
+const AttributeName attributeNames[] = {
+	{ a_Position, "a_Position" },
+	{ a_Color, "a_Color" },
+	{ a_TexCoord, "a_TexCoord" },
+	{ a_InstanceMatrix, "a_InstanceMatrix" },
+	{ a_InstanceColor, "a_InstanceColor" },
+	{ a_Ridge, "a_Ridge" },
+};
 
-void initLand(Primitives &o, const char* file, int chunk_x, int chunk_y){
-	// Create a Plane
-	//  v1------v0----
-	//  |       | 
-	//  |       |
-	//  |       |
-	//  v2------v3---- 
-	//  |       |
-	//  |       |
+//A program being built. With KHR_parallel_shader_compile the driver
+//compiles and links on its own threads, and programDone can be polled each
+//frame without stalling; without it the first status query waits instead.
+struct PendingProgram {
+	GLuint program;
+	GLuint vs, fs;
+	string cachePath;	//where to save the binary once linked, "" for nowhere
+	bool cached;	//loaded from the cache, nothing left to wait for
+};
 
-	vector<float> v;
-	vector<float> cs;
-	vector<float> t;
-	vector<unsigned int> i;
-	int c = 0; //count
-	int tex = 1;
-	float s = .1; //size
-	float f = s *.5; //offset
-	float old_h = 0;
+//Compile, bind attribute locations and link, without waiting for any of it
+PendingProgram startProgram( const char* vertex, const char* fragment, bool retrievable ){
+    PendingProgram p;
+    p.vs = startShader( GL_VERTEX_SHADER, vertex );
+    p.fs = startShader( GL_FRAGMENT_SHADER, fragment );
+    p.cached = false;
 
-	int ls = 216; //land size
-	float cx = (chunk_x) * ls;
-	float cy = (chunk_y) * ls;
+    p.program = glCreateProgram();
+    glAttachShader( p.program, p.vs );
+    glAttachShader( p.program, p.fs );
 
-  	for (int y = 0; y < ls; y++){
-		for (int x = 0; x < ls; x++){
+    //Storage locations for Attributes
+    for (size_t k = 0; k < sizeof(attributeNames) / sizeof(attributeNames[0]); k++){
+        glBindAttribLocation( p.program, attributeNames[k].id, attributeNames[k].name );
+    }
+    if (retrievable){
+        glProgramParameteri( p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+    }
 
-			float h[] = {0,0,0,0};
-			float H[] = {0,0,0,0};
-			//Generate individual height of plane corners that make up land
-			for (int it = 0; it < 4; it++){
-				int iy = it % 2;
-				int ix = floor(it/2);
-				float z = sqrt( (x+ix+cx-ls)*(x+ix+cx-ls)+(y+iy+cy-ls)*(y+iy+cy-ls)) / (128.0) * 2.5;
-				if (z > 4){ z = 4; }
-				//Fine Ridges                  //.025 default
-				h[it] = ridgenoise( (y+iy+cy)*.025, (x+ix+cx)*.025,  1, 1);
-				if (h[it] >= .9) h[it] = h[it] = .9;
-				//Rolling Mountains (height of ridges across an area)
-				                           //.015 default
-				H[it] = perlin2d( (y+iy+cy)*.015, (x+ix+cx)*.015, .5, 1)+1;
-				h[it] = pow(h[it], 2);
-				H[it] = pow(H[it], z*2);
-				if (z < .5){
-					h[it]*=(z*2);
-				}
-				
-			}
-			v.insert(v.end(), {
-				f+x*s, h[3]*H[3], f+y*s,
-			   -f+x*s, h[1]*H[1], f+y*s,
-			   -f+x*s, h[0]*H[0], -f+y*s,
-				f+x*s, h[2]*H[2], -f+y*s} );
-			t.insert(t.end(), {tex+x, tex+y,    0.0+x, tex+y,     0.0+x, 0.0+y,   tex+x, 0.0+y} );
-			i.insert(i.end(), {0+c*4, 1+c*4, 2+c*4,    0+c*4, 2+c*4, 3+c*4} );
-			
-			float g[] = {0,0,0,0}; //Sharpness of colors on ends of mountains
-			for(int it = 0; it < 4; it++){
-				g[it] = pow(h[it],1); //*.5+.25
-			}
+    //Must link after BindAttrib
+    glLinkProgram( p.program );
+    return p;
+}
 
-			if (makeRand != 0){
-				world.q = world.q;
-				world.w = world.w;
-				world.j = world.j;
-			}
+bool programDone( const PendingProgram &p ){
+    if (p.cached || !GLEW_KHR_parallel_shader_compile) return true;
+    GLint done = GL_FALSE;
+    glGetProgramiv( p.program, GL_COMPLETION_STATUS_KHR, &done );
+    return done == GL_TRUE;
+}
 
-			srand(SEED);
-			if (y == 0 && x == 0)
-				cout << "world.q = " << 
-					world.q << "; world.w = " << world.w 
-					<< "; world.j = " <<  world.j << ";" << endl;
-			//cout << "r:" << red << " g:" << gre << " b:" << blu << endl;
-			float red = world.red; float q = world.q;
-			float gre = world.gre; float w = world.w;
-			float blu = world.blu; float j = world.j;
-			cs.insert(cs.end(), {red-g[3]*q, gre-g[3]*w, blu-g[3]*j, 1,
-        						 red-g[1]*q, gre-g[1]*w, blu-g[1]*j, 1, 
-        						 red-g[0]*q, gre-g[0]*w, blu-g[0]*j, 1,
-    							 red-g[2]*q, gre-g[2]*w, blu-g[2]*j, 1 } ); 
-			/*cs.insert(cs.end(), {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 } );*/
-			c += 1;
-		}
-	}
+//Check a started program, printing any logs. Returns 0 on failure.
+GLuint finishProgram( PendingProgram &p ){
+    bool compiled = shaderCompiled( p.vs, "Vertex" );
+    compiled = shaderCompiled( p.fs, "Fragment" ) && compiled;
+    glDeleteShader( p.vs );
+    glDeleteShader( p.fs );
+
+    GLint status = GL_FALSE;
+    if (compiled) glGetProgramiv( p.program, GL_LINK_STATUS, &status );
+    if( status == GL_FALSE ){
+        if (compiled){
+            GLint maxLength = 0;
+            glGetProgramiv( p.program, GL_INFO_LOG_LENGTH, &maxLength );
+            std::vector<GLchar> errorLog(maxLength + 1);
+            glGetProgramInfoLog( p.program, maxLength, &maxLength, &errorLog[0] );
+            cerr << "Program link failed." << endl << &errorLog[0] << endl;
+        }
+        glDeleteProgram( p.program );
+        return 0;
+    }
+    return p.program;
+}
 
-	GLfloat vertices[ v.size() ];
-	copy(v.begin(), v.end(), vertices);
+//Drop a program still being built
+void cancelProgram( PendingProgram &p ){
+    glDeleteProgram( p.program );
+    if (!p.cached){
+        glDeleteShader( p.vs );
+        glDeleteShader( p.fs );
+    }
+}
 
-	GLfloat colors[ cs.size() ];
-	copy(cs.begin(), cs.end(), colors);
+/////////////////////Program Cache
+//Linked programs are saved with glGetProgramBinary, keyed by their sources,
+//the attribute layout and the driver's vendor/renderer/version strings, and
+//loaded with glProgramBinary on later launches. A missing, stale or rejected
+//binary just means compiling as before.
+
+struct ShaderStats {
+	int programs = 0;
+	int cached = 0;
+	double ms = 0;
+} shaderStats;
+
+const uint32_t programCacheMagic = 0x47525050;	//"PPRG"
+
+string programCacheDir(){
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	string dir;
+	if (xdg && *xdg) dir = xdg;
+	else if (home && *home) dir = string(home) + "/.cache";
+	else return "";
+	mkdir(dir.c_str(), 0755);
+	dir += "/opengl-land";
+	mkdir(dir.c_str(), 0755);
+	return dir;
+}
 
-	GLfloat texCoords[ t.size() ];
-	copy(t.begin(), t.end(), texCoords);
+uint64_t programKey(const char* vertex, const char* fragment){
+	size_t lengths[2] = { strlen(vertex), strlen(fragment) };
+	uint64_t h = fnv1a(lengths, sizeof(lengths));
+	h = fnv1a(vertex, lengths[0], h);
+	h = fnv1a(fragment, lengths[1], h);
+	for (size_t k = 0; k < sizeof(attributeNames) / sizeof(attributeNames[0]); k++){
+		h = fnv1a(&attributeNames[k].id, sizeof(int), h);
+		h = fnv1a(attributeNames[k].name, strlen(attributeNames[k].name) + 1, h);
+	}
+	GLenum driver[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+	for (int k = 0; k < 4; k++){
+		const char* s = (const char*)glGetString(driver[k]);
+		if (s) h = fnv1a(s, strlen(s) + 1, h);
+	}
+	return h;
+}
 
-	GLuint indices[ i.size() ];
-	copy(i.begin(), i.end(), indices);
+string programCachePath(uint64_t key){
+	static string dir = programCacheDir();
+	if (dir.empty()) return "";
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+	return dir + name;
+}
 
-    o.numIndices = sizeof(indices) / 4;
+GLuint loadCachedProgram(const string &path){
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f) return 0;
+	uint32_t header[2];
+	vector<char> binary;
+	if (fread(header, sizeof(header), 1, f) == 1 && header[0] == programCacheMagic){
+		char buffer[65536];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0){
+			binary.insert(binary.end(), buffer, buffer + n);
+		}
+	}
+	fclose(f);
+	if (binary.empty()) return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary( program, header[1], &binary[0], binary.size() );
+	GLint status;
+	glGetProgramiv( program, GL_LINK_STATUS, &status );
+	if (status == GL_FALSE){ //driver update, or a binary it no longer takes
+		glDeleteProgram( program );
+		return 0;
+	}
+	return program;
+}
 
-    // Create buffer objects
-	glGenBuffers( 1, &o.vertexBuffer);
-	glGenBuffers( 1, &o.colorBuffer );
-	glGenBuffers( 1, &o.indexBuffer );
-	glGenBuffers( 1, &o.texCoordBuffer );
-	glGenTextures( 1, &o.textureID );
+void saveCachedProgram(const string &path, GLuint program){
+	GLint length = 0;
+	glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+	if (length <= 0) return;
+	vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary( program, length, &length, &format, &binary[0] );
+
+	//Write aside and rename, so a crash never leaves half a binary behind
+	string temporary = path + ".tmp";
+	FILE* f = fopen(temporary.c_str(), "wb");
+	if (!f) return;
+	uint32_t header[2] = { programCacheMagic, format };
+	bool ok = fwrite(header, sizeof(header), 1, f) == 1 &&
+		fwrite(&binary[0], 1, length, f) == (size_t)length;
+	ok = fclose(f) == 0 && ok;
+	if (ok) rename(temporary.c_str(), path.c_str());
+	else remove(temporary.c_str());
+}
 
-    //Position
-    glBindBuffer( GL_ARRAY_BUFFER, o.vertexBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(vertices), &vertices[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_Position, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(a_Position);
+//Start building a program for these sources: straight from the cache when
+//possible, otherwise compiling and linking in the background
+PendingProgram requestProgram( const char* vertex, const char* fragment ){
+	GLint formats = 0;
+	if (GLEW_ARB_get_program_binary) glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+	string path = formats > 0 ? programCachePath(programKey(vertex, fragment)) : "";
+
+	GLuint program = path.empty() ? 0 : loadCachedProgram(path);
+	if (program){
+		shaderStats.cached++;
+		PendingProgram p = { program, 0, 0, "", true };
+		return p;
+	}
+	PendingProgram p = startProgram(vertex, fragment, !path.empty());
+	p.cachePath = path;
+	return p;
+}
 
-    //Color
-    glBindBuffer( GL_ARRAY_BUFFER, o.colorBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(colors), &colors[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_Color, 4, GL_FLOAT, GL_FALSE, 0, 0 );
-    glEnableVertexAttribArray(a_Color);
+//Program of a finished request, saving a freshly linked binary. Returns 0
+//on failure.
+GLuint completeProgram( PendingProgram &p ){
+	if (p.cached) return p.program;
+	GLuint program = finishProgram(p);
+	if (program && !p.cachePath.empty()) saveCachedProgram(p.cachePath, program);
+	return program;
+}
 
-    //Index Buffer
-    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, o.indexBuffer);
-    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), &indices[0], GL_STATIC_DRAW);
+//Program for these sources, waiting for it. Returns 0 on failure.
+GLuint createProgram( const char* vertex, const char* fragment ){
+	Trace t("program");
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	PendingProgram p = requestProgram(vertex, fragment);
+	GLuint program = completeProgram(p);
+	shaderStats.programs++;
+	shaderStats.ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	return program;
+}
 
-	//Texture Coordinates
-    glBindBuffer( GL_ARRAY_BUFFER, o.texCoordBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(texCoords), &texCoords[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_TexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(a_TexCoord);
+/////////////////////Shader Variants
+//Optional effects live in #ifdef blocks of the shader sources. A variant is
+//the source with one #define per enabled feature bit inserted after its
+//#version line, so a disabled effect is not in the program at all.
 
-    //Bind Texture
-    glEnable(GL_TEXTURE_2D);
-    glActiveTexture( GL_TEXTURE0);
-    glBindTexture(   GL_TEXTURE_2D, o.textureID);
-
-    if (file != "None"){
-	    int w, h;
-	    unsigned char* image = SOIL_load_image(file, &w, &h, 0, SOIL_LOAD_RGB);
-	    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w,h,
-	    	0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        SOIL_free_image_data(image);
-	}else{	
-   		float pixels[] = {
-    		1.0f, .9f, 1.0f,   .9f, 1.0f, .9f,
-    		1.0f, .9f, .9f,   .9f, .9f, 1.0f,
-		};
-
-	    //Target active unit, level, internalformat, width, height, border, format, type, data
-	    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 2, 2,
-	    	0, GL_RGB, GL_FLOAT, pixels);
-    }
+enum {
+	SHADER_STRIPES = 1,	//noise-warped stripes across the land
+	SHADER_TURB = 2,	//turbulence bands added on top
+};
 
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glGenerateMipmap(GL_TEXTURE_2D);
+struct ShaderFeature {
+	unsigned bit;
+	const char* name;	//also the #define, upper-cased
+};
 
-    //No Buffer Bound
-	glBindBuffer( GL_ARRAY_BUFFER, NULL);
-	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, NULL);
+const ShaderFeature shaderFeatures[] = {
+	{ SHADER_STRIPES, "stripes" },
+	{ SHADER_TURB, "turb" },
+};
+const int shaderFeatureCount = sizeof(shaderFeatures) / sizeof(shaderFeatures[0]);
+
+string shaderVariant(const char* source, unsigned features){
+	string defines;
+	for (int k = 0; k < shaderFeatureCount; k++){
+		if (!(features & shaderFeatures[k].bit)) continue;
+		string name = shaderFeatures[k].name;
+		for (size_t c = 0; c < name.size(); c++) name[c] = toupper(name[c]);
+		defines += "#define " + name + "\n";
+	}
+	string s = source;
+	size_t version = s.find("#version");
+	size_t at = version == string::npos ? 0 : s.find('\n', version);
+	at = at == string::npos ? s.size() : at + (version == string::npos ? 0 : 1);
+	return s.insert(at, defines);
 }
 
+//"stripes,turb" -> feature bits; false on an unknown name
+bool parseShaderFeatures(const string &list, unsigned &features){
+	features = 0;
+	size_t start = 0;
+	while (start < list.size()){
+		size_t end = list.find(',', start);
+		if (end == string::npos) end = list.size();
+		string name = list.substr(start, end - start);
+		bool found = name.empty() || name == "none";
+		for (int k = 0; k < shaderFeatureCount && !found; k++){
+			if (name == shaderFeatures[k].name){
+				features |= shaderFeatures[k].bit;
+				found = true;
+			}
+		}
+		if (!found){
+			fprintf(stderr, "Unknown shader effect %s\n", name.c_str());
+			return false;
+		}
+		start = end + 1;
+	}
+	return true;
+}
 
-void initPlane(Primitives &o, const char* file){
-	// Create a Plane
-	//  v1------v0
+string shaderFeatureNames(unsigned features){
+	string names;
+	for (int k = 0; k < shaderFeatureCount; k++){
+		if (!(features & shaderFeatures[k].bit)) continue;
+		if (!names.empty()) names += ",";
+		names += shaderFeatures[k].name;
+	}
+	return names.empty() ? "none" : names;
+}
+
+//The land and prop shaders are files in shaderDir, read at startup and
+//watched while running. An edit is rebuilt in the background and swapped in
+//once every variant of it has linked; a broken edit keeps the old programs.
+string shaderDir = "shaders";
+
+bool readText(const string &path, string &text){
+	FILE* f = fopen(path.c_str(), "rb");
+	if (!f){
+		fprintf(stderr, "Could not open %s\n", path.c_str());
+		return false;
+	}
+	text.clear();
+	char buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) text.append(buffer, n);
+	fclose(f);
+	return true;
+}
+
+//Programs built from one vertex/fragment pair, one per feature set, linked
+//the first time each set is asked for
+struct ProgramVariants {
+	const char* vertexFile;
+	const char* fragmentFile;
+	string vertex, fragment;
+	map<unsigned, GLuint> programs;
+
+	//A reload in flight: its sources and one build per existing variant
+	string nextVertex, nextFragment;
+	map<unsigned, PendingProgram> pending;
+
+	ProgramVariants(const char* vertexFile, const char* fragmentFile) :
+		vertexFile(vertexFile), fragmentFile(fragmentFile) {}
+
+	bool read(string &vs, string &fs){
+		return readText(shaderDir + "/" + vertexFile, vs) &&
+			readText(shaderDir + "/" + fragmentFile, fs);
+	}
+
+	bool load(){ return read(vertex, fragment); }
+
+	void label(GLuint p, unsigned features){
+		labelObject(GL_PROGRAM, p, string(vertexFile) + " + " + fragmentFile + " (" + shaderFeatureNames(features) + ")");
+	}
+
+	bool uses(const string &file){
+		return file == vertexFile || file == fragmentFile;
+	}
+
+	GLuint get(unsigned features){
+		map<unsigned, GLuint>::iterator it = programs.find(features);
+		if (it != programs.end()) return it->second;
+		string vs = shaderVariant(vertex.c_str(), features);
+		string fs = shaderVariant(fragment.c_str(), features);
+		GLuint p = createProgram( vs.c_str(), fs.c_str() );
+		if (p) programs[features] = p;
+		label(p, features);
+		return p;
+	}
+
+	//Start rebuilding every variant from the files as they are now,
+	//replacing any reload still in flight
+	void reload(){
+		string vs, fs;
+		if (!read(vs, fs)) return;
+		for (map<unsigned, PendingProgram>::iterator it = pending.begin(); it != pending.end(); ++it){
+			cancelProgram(it->second);
+		}
+		pending.clear();
+		nextVertex = vs;
+		nextFragment = fs;
+		for (map<unsigned, GLuint>::iterator it = programs.begin(); it != programs.end(); ++it){
+			string v = shaderVariant(vs.c_str(), it->first);
+			string f = shaderVariant(fs.c_str(), it->first);
+			pending[it->first] = requestProgram( v.c_str(), f.c_str() );
+		}
+		if (programs.empty()){
+			vertex = vs;
+			fragment = fs;
+		}
+	}
+
+	//Once per frame: true when a reload has finished and replaced every
+	//variant. Nothing is swapped unless all of them linked.
+	bool poll(){
+		if (pending.empty()) return false;
+		for (map<unsigned, PendingProgram>::iterator it = pending.begin(); it != pending.end(); ++it){
+			if (!programDone(it->second)) return false;
+		}
+		map<unsigned, GLuint> built;
+		bool ok = true;
+		for (map<unsigned, PendingProgram>::iterator it = pending.begin(); it != pending.end(); ++it){
+			GLuint p = completeProgram(it->second);
+			if (p){
+				built[it->first] = p;
+				label(p, it->first);
+			}else{
+				ok = false;
+			}
+		}
+		pending.clear();
+		if (!ok){
+			for (map<unsigned, GLuint>::iterator it = built.begin(); it != built.end(); ++it){
+				glDeleteProgram( it->second );
+			}
+			fprintf(stderr, "Keeping the previous %s + %s\n", vertexFile, fragmentFile);
+			return false;
+		}
+		//Deleting the bound program is deferred until it is unbound
+		for (map<unsigned, GLuint>::iterator it = programs.begin(); it != programs.end(); ++it){
+			glDeleteProgram( it->second );
+		}
+		programs = built;
+		vertex = nextVertex;
+		fragment = nextFragment;
+		return true;
+	}
+};
+
+ProgramVariants terrainShaders("land.vert", "land.frag");
+ProgramVariants instanceShaders("props.vert", "land.frag");
+unsigned terrainFeatures = 0;
+
+void initUniforms(uniformStruct &s, GLuint p){
+	s.Translation = glGetUniformLocation( p, "u_Translation" );
+	s.ProjMatrix = glGetUniformLocation( p, "u_ProjMatrix");
+	s.ViewMatrix = glGetUniformLocation( p, "u_ViewMatrix");
+	s.ModelMatrix = glGetUniformLocation( p, "u_ModelMatrix");
+	s.Sampler = glGetUniformLocation( p, "u_Sampler");
+	s.Layer = glGetUniformLocation( p, "u_Layer");
+	s.Time = glGetUniformLocation( p, "u_Time");
+	s.Base = glGetUniformLocation( p, "u_Base");
+	s.RidgeTint = glGetUniformLocation( p, "u_RidgeTint");
+	s.Paletted = glGetUniformLocation( p, "u_Paletted");
+}
+
+//Switch the land to the variant with these features; keeps the current
+//program if that one fails to build
+bool useTerrainFeatures(unsigned features){
+	GLuint p = terrainShaders.get(features);
+	if (p == 0) return false;
+	terrainFeatures = features;
+	program = p;
+	initUniforms(u, program);
+	glUseProgram( program );
+	return true;
+}
+
+void cycleTerrainFeatures(){
+	unsigned next = (terrainFeatures + 1) % (1 << shaderFeatureCount);
+	if (useTerrainFeatures(next)) printf("Effects: %s\n", shaderFeatureNames(next).c_str());
+}
+
+//A watched shader file changed: rebuild whatever is made from it
+void reloadShaders(const string &file){
+	if (terrainShaders.uses(file)) terrainShaders.reload();
+	if (instanceShaders.uses(file)) instanceShaders.reload();
+}
+
+void watchShaders(){
+	const char* files[] = { terrainShaders.vertexFile, terrainShaders.fragmentFile,
+		instanceShaders.vertexFile, instanceShaders.fragmentFile };
+	for (int k = 0; k < 4; k++){
+		bool seen = false;
+		for (int n = 0; n < k; n++) seen = seen || strcmp(files[n], files[k]) == 0;
+		if (seen) continue;
+		string file = files[k];
+		watchFile(shaderDir + "/" + file, [file]{ reloadShaders(file); });
+	}
+}
+
+//Once per frame: swap in any reload that finished. Only the programs and
+//their uniform locations change; the geometry stays as it is.
+void pollShaders(){
+	if (terrainShaders.poll()){
+		program = terrainShaders.get(terrainFeatures);
+		initUniforms(u, program);
+		glUseProgram( program );
+		printf("Reloaded %s + %s\n", terrainShaders.vertexFile, terrainShaders.fragmentFile);
+	}
+	if (instanceShaders.poll()){
+		instanceProgram = instanceShaders.get(0);
+		initUniforms(ui, instanceProgram);
+		printf("Reloaded %s + %s\n", instanceShaders.vertexFile, instanceShaders.fragmentFile);
+	}
+}
+
+/////////////////////Workers
+//Background threads for CPU-only work such as chunk generation. Anything
+//that needs GL is handed back with runOnMain and executed on the GLUT thread
+//by runMainTasks at the start of display(), for at most --upload-budget ms a
+//frame; whatever is left waits for the next frame.
+//
+//Each worker has its own queue, ordered by priority (lower runs first, e.g.
+//distance from the player). Jobs a worker releases stay on its queue; an
+//idle worker steals the most urgent job from another's. A job can wait on
+//others: link them with jobAfter before submitting any of them. A job is
+//deleted once it has run unless it is pooled, i.e. kept by its owner and
+//rearmed for the next use, like the ones a ChunkJob builds with.
+
+struct Job {
+	function<void()> run;
+	float priority;
+	atomic<int> waiting{1};	//unfinished jobs it waits on, plus one until submitted
+	vector<Job*> next;	//released when this one finishes
+	bool pooled = false;	//its owner deletes it
+};
+
+struct WorkerQueue {
+	mutex lock;
+	vector<Job*> jobs;	//heap, most urgent first
+};
+
+struct WorkerPool {
+	vector<thread> threads;
+	vector<WorkerQueue*> queues;
+	mutex lock;	//only for sleeping and waking
+	condition_variable wake;
+	atomic<int> queued{0};
+	atomic<unsigned> nextQueue{0};	//round robin for jobs from outside the pool
+	atomic<long> steals{0};
+	atomic<bool> quit{false};
+} workers;
+
+thread_local int workerIndex = -1;
+
+bool laterJob(const Job* a, const Job* b){
+	return a->priority > b->priority;
+}
+
+//Bounded lock-free queue of tasks for the GLUT thread: many producers, one
+//consumer. Each cell's sequence says whose turn it is (Vyukov): pos when a
+//producer may fill it, pos + 1 once filled, pos + size once drained. A
+//producer finding it full waits on its own thread; the GLUT thread never
+//waits on a producer.
+struct MainQueue {
+	static const unsigned size = 1024;	//power of two
+	struct Cell {
+		atomic<unsigned> sequence;
+		function<void()> task;
+	};
+	Cell cells[size];
+	atomic<unsigned> tail{0};	//next cell to fill
+	atomic<unsigned> head{0};	//next cell to drain, moved by the GLUT thread only
+
+	//Backpressure: how deep it got, and how often and long producers waited
+	atomic<int> peak{0};
+	atomic<long> stalls{0};
+	atomic<long> stallUs{0};
+	int deferred = 0;	//frames that left tasks for the next frame
+
+	MainQueue(){
+		for (unsigned k = 0; k < size; k++) cells[k].sequence.store(k, memory_order_relaxed);
+	}
+
+	int depth(){
+		return tail.load(memory_order_relaxed) - head.load(memory_order_relaxed);
+	}
+
+	bool push(function<void()> &task){
+		unsigned pos = tail.load(memory_order_relaxed);
+		Cell* c;
+		for (;;){
+			c = &cells[pos & (size - 1)];
+			int turn = c->sequence.load(memory_order_acquire) - pos;
+			if (turn == 0){
+				if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+			}else if (turn < 0){
+				return false;	//full: the cell still holds a task from a lap ago
+			}else{
+				pos = tail.load(memory_order_relaxed);
+			}
+		}
+		c->task = move(task);
+		c->sequence.store(pos + 1, memory_order_release);
+		int d = min(depth(), (int)size), p = peak.load(memory_order_relaxed);
+		while (d > p && !peak.compare_exchange_weak(p, d, memory_order_relaxed)) {}
+		return true;
+	}
+
+	bool pop(function<void()> &task){
+		unsigned pos = head.load(memory_order_relaxed);
+		Cell &c = cells[pos & (size - 1)];
+		if ((int)(c.sequence.load(memory_order_acquire) - (pos + 1)) < 0) return false;
+		task = move(c.task);
+		c.task = nullptr;
+		c.sequence.store(pos + size, memory_order_release);
+		head.store(pos + 1, memory_order_relaxed);
+		return true;
+	}
+} mainQueue;
+
+float uploadBudgetMs = 4;	//--upload-budget; 0: drain everything every frame
+thread_local bool glThread = false;
+vector< function<void()> > glThreadTasks;	//runOnMain from the GLUT thread itself
+
+Job* newJob(function<void()> run, float priority = 0){
+	Job* job = new Job;
+	job->run = move(run);
+	job->priority = priority;
+	return job;
+}
+
+//A pooled job that has run, ready to be linked and submitted again
+void rearmJob(Job* job, float priority){
+	job->priority = priority;
+	job->waiting = 1;
+	job->next.clear();
+}
+
+//job runs once first has finished. Link before submitting first.
+void jobAfter(Job* job, Job* first){
+	job->waiting++;
+	first->next.push_back(job);
+}
+
+void queueJob(Job* job){
+	int n = workers.queues.size();
+	if (n == 0){ //stopped at exit
+		if (!job->pooled) delete job;
+		return;
+	}
+	int k = workerIndex >= 0 ? workerIndex : workers.nextQueue++ % n;
+	WorkerQueue &q = *workers.queues[k];
+	{
+		lock_guard<mutex> l(q.lock);
+		q.jobs.push_back(job);
+		push_heap(q.jobs.begin(), q.jobs.end(), laterJob);
+	}
+	workers.queued++;
+	//Taking the lock orders this against a worker about to sleep
+	{ lock_guard<mutex> l(workers.lock); }
+	workers.wake.notify_one();
+}
+
+//Drop one of job's waits; it is queued when none are left
+void releaseJob(Job* job){
+	if (job->waiting.fetch_sub(1) == 1) queueJob(job);
+}
+
+void submitJob(Job* job){
+	releaseJob(job);
+}
+
+void runAsync(function<void()> run, float priority = 0){
+	submitJob(newJob(move(run), priority));
+}
+
+Job* popJob(WorkerQueue &q){
+	lock_guard<mutex> l(q.lock);
+	if (q.jobs.empty()) return 0;
+	pop_heap(q.jobs.begin(), q.jobs.end(), laterJob);
+	Job* job = q.jobs.back();
+	q.jobs.pop_back();
+	return job;
+}
+
+//Own queue first, then the others in turn
+Job* findJob(int index){
+	int n = workers.queues.size();
+	Job* job = popJob(*workers.queues[index]);
+	for (int k = 1; k < n && !job; k++){
+		job = popJob(*workers.queues[(index + k) % n]);
+		if (job) workers.steals++;
+	}
+	if (job) workers.queued--;
+	return job;
+}
+
+void workerLoop(int index){
+	nameTraceThread("worker " + to_string(index));
+	workerIndex = index;
+	for (;;){
+		Job* job = findJob(index);
+		if (!job){
+			unique_lock<mutex> l(workers.lock);
+			workers.wake.wait(l, []{ return workers.quit || workers.queued > 0; });
+			if (workers.quit) return;
+			continue;
+		}
+		//A pooled graph can be rearmed once this job's last release is made,
+		//so that is the last time job is touched
+		bool pooled = job->pooled;
+		size_t n = job->next.size();
+		job->run();
+		for (size_t k = 0; k < n; k++){
+			releaseJob(job->next[k]);
+		}
+		if (!pooled) delete job;
+	}
+}
+
+//n threads; 0: one per core but the GLUT thread's
+void startWorkers(int n = 0){
+	if (n <= 0) n = thread::hardware_concurrency() - 1;
+	if (n < 1) n = 1;
+	workers.quit = false;
+	for (int k = 0; k < n; k++){
+		workers.queues.push_back(new WorkerQueue);
+	}
+	for (int k = 0; k < n; k++){
+		workers.threads.push_back(thread(workerLoop, k));
+	}
+}
+
+//Registered with atexit: the 'z' key exits from inside glutMainLoop. Jobs
+//still queued are dropped.
+void stopWorkers(){
+	{
+		lock_guard<mutex> l(workers.lock);
+		workers.quit = true;
+	}
+	workers.wake.notify_all();
+	for (size_t k = 0; k < workers.threads.size(); k++){
+		workers.threads[k].join();
+	}
+	workers.threads.clear();
+	for (size_t k = 0; k < workers.queues.size(); k++){
+		delete workers.queues[k];
+	}
+	workers.queues.clear();
+	workers.queued = 0;
+}
+
+//Workers wait here while the queue is full; the GLUT thread cannot wait on
+//itself, so its own tasks go to a side list
+void runOnMain(function<void()> task){
+	if (glThread){
+		glThreadTasks.push_back(move(task));
+		return;
+	}
+	if (mainQueue.push(task)) return;
+	mainQueue.stalls++;
+	auto start = chrono::steady_clock::now();
+	while (!mainQueue.push(task)){
+		if (workers.quit) return;	//exiting: nobody is draining
+		this_thread::sleep_for(chrono::microseconds(100));
+	}
+	mainQueue.stallUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+void runMainTasks(){
+	auto start = chrono::steady_clock::now();
+	vector< function<void()> > own;
+	own.swap(glThreadTasks);
+	for (size_t k = 0; k < own.size(); k++){
+		own[k]();
+	}
+	function<void()> task;
+	while (mainQueue.pop(task)){
+		task();
+		task = nullptr;
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (uploadBudgetMs > 0 && ms >= uploadBudgetMs){
+			if (mainQueue.depth() > 0) mainQueue.deferred++;
+			break;
+		}
+	}
+}
+
+/////////////////////Texture Array
+//Every image is resampled into one layer of a single GL_TEXTURE_2D_ARRAY.
+//The whole frame binds that array once and draws pick their layer with a
+//uniform, so streamed chunks and prop batches never change texture bindings.
+//The 2D texture an image is loaded into is only staging and is deleted once
+//its layer is written.
+
+const int layerSize = 512;
+const int layerLevels = 10;
+
+struct TextureLayers {
+	GLuint id = 0;
+	GLuint fbo = 0;
+	GLuint copyProgram = 0;
+	GLint copySource;
+	int capacity = 0;
+	int count = 0;	//layers ever handed out
+	vector<int> free;
+} layers;
+
+//Full screen triangle sampling a 2D texture; resamples into a layer
+static const char* copy_vertex_source =
+    "   #version 130 \n"
+    "   out vec2 v_TexCoord; \n"
+    "   void main() { \n"
+    "       vec2 p = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0); \n"
+    "       v_TexCoord = (p + 1.0) * 0.5; \n"
+    "       gl_Position = vec4(p, 0.0, 1.0); \n"
+    "   } \n";
+
+static const char* copy_fragment_source =
+    "   #version 130 \n"
+    "   uniform sampler2D u_Source; \n"
+    "   in vec2 v_TexCoord; \n"
+    "   void main() { \n"
+    "       gl_FragColor = texture(u_Source, v_TexCoord); \n"
+    "   } \n";
+
+//(Re)allocate the array with room for capacity layers, keeping what is there
+void resizeLayers(int capacity){
+	GLuint id;
+	genTextures( MEM_TEXTURES, 1, &id );
+	glActiveTexture( GL_TEXTURE0);
+	glBindTexture( GL_TEXTURE_2D_ARRAY, id);
+	for (int l = 0; l < layerLevels; l++){
+		texImage3D(id, GL_TEXTURE_2D_ARRAY, l, GL_RGBA8, layerSize >> l, layerSize >> l,
+			capacity, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, layerLevels - 1);
+
+	//Every level of the layers in use is copied across as it is, so nothing
+	//needs its mips rebuilt
+	if (layers.id){
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, layers.fbo);
+		for (int layer = 0; layer < layers.count; layer++){
+			for (int l = 0; l < layerLevels; l++){
+				glFramebufferTextureLayer( GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layers.id, l, layer);
+				glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, layer, 0, 0, layerSize >> l, layerSize >> l);
+			}
+		}
+		//Detached first: an attachment keeps the old array's storage alive
+		glFramebufferTextureLayer( GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, 0);
+		deleteTextures( 1, &layers.id );
+	}
+	layers.id = id;
+	layers.capacity = capacity;
+	labelObject(GL_TEXTURE, id, "texture layers");
+}
+
+void initLayers(){
+	layers.copyProgram = createProgram( copy_vertex_source, copy_fragment_source );
+	layers.copySource = glGetUniformLocation( layers.copyProgram, "u_Source");
+	glGenFramebuffers( 1, &layers.fbo );
+	glBindFramebuffer( GL_FRAMEBUFFER, layers.fbo );
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	labelObject(GL_FRAMEBUFFER, layers.fbo, "layer copy");
+	labelObject(GL_PROGRAM, layers.copyProgram, "layer copy");
+	resizeLayers(8);
+}
+
+int allocLayer(){
+	if (!layers.free.empty()){
+		int layer = layers.free.back();
+		layers.free.pop_back();
+		return layer;
+	}
+	if (layers.count == layers.capacity){
+		//The old array is freed once copied, so only the growth counts
+		long layer = 0;
+		for (int l = 0; l < layerLevels; l++) layer += (long)(layerSize >> l) * (layerSize >> l) * 4;
+		if (!gpuBudgetAllows(layer * layers.capacity, "texture layers")) return -1;
+		resizeLayers(layers.capacity * 2);
+	}
+	return layers.count++;
+}
+
+void freeLayer(int layer){
+	layers.free.push_back(layer);
+}
+
+//Draw source into every mip level of layer, and only that layer. Each level
+//is drawn at its own size, so trilinear sampling picks the source's matching
+//mip. Leaves the default framebuffer, viewport and program bound.
+void copyToLayer(GLuint source, int layer){
+	glBindFramebuffer( GL_FRAMEBUFFER, layers.fbo);
+	glDisable( GL_DEPTH_TEST );
+	glUseProgram( layers.copyProgram );
+	glActiveTexture( GL_TEXTURE1);
+	glBindTexture( GL_TEXTURE_2D, source);
+	glUniform1i( layers.copySource, 1);
+
+	for (int l = 0; l < layerLevels; l++){
+		glFramebufferTextureLayer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layers.id, l, layer);
+		glViewport( 0, 0, layerSize >> l, layerSize >> l );
+		glDrawArrays( GL_TRIANGLES, 0, 3);
+	}
+	glActiveTexture( GL_TEXTURE0);
+
+	glBindFramebuffer( GL_FRAMEBUFFER, 0);
+	glViewport( 0, 0, WIDTH, HEIGHT );
+	glEnable( GL_DEPTH_TEST );
+	glUseProgram( program );
+}
+
+/////////////////////Textures
+//Every texture starts out with a small procedural image so it can be drawn
+//immediately. Image files are mapped and hashed on the worker pool, decoded
+//only if their content is new, and uploaded through a pixel unpack buffer.
+//A file baked by ../Bake (name.ltex beside name.png) is preferred: its mip
+//chain is uploaded straight from the mapping with no decode at all.
+//Primitives hold a cache slot rather than a GL name, so the slot can move
+//from its placeholder to the loaded image without anyone noticing.
+
+GLuint unpackBuffer = 0;
+int texturesPending = 0;
+bool bakedFormats[4] = { true, false, false, false }; //set from GLEW in main
+
+//Textures are shared at two levels. A slot is what a Primitives holds: one
+//per file path (or per distinct placeholder). Nothing Land draws is ever let
+//go of, so slots are not counted and live for the whole process. A slot
+//points at an image, which is one GL texture per content hash, so identical
+//placeholders and different paths to the same bytes end up on one texture.
+//Images are reference counted by the slots showing or loading them: a
+//placeholder's image goes once its file has taken over.
+struct TextureImage {
+	GLuint id;
+	uint64_t hash;
+	int refs;
+	int layer;	//in the texture array, -1 until ready
+	bool ready;	//pixels uploaded
+};
+
+struct TextureSlot {
+	string key;
+	int image;	//what binds now
+	int loading;	//image the file is going into, -1 when settled
+};
+
+struct TextureCache {
+	vector<TextureImage> images;
+	vector<TextureSlot> slots;
+	vector<int> freeImages;
+	map<string, int> byKey;
+	map<uint64_t, int> byHash;
+} textures;
+
+int textureLayer(int slot){
+	return textures.images[textures.slots[slot].image].layer;
+}
+
+//Bind texture to unit 0 and give it RGB float pixels with the repo's
+//sampling state
+void initTexture(GLuint texture, int w, int h, const float* pixels){
+    glActiveTexture( GL_TEXTURE0);
+    glBindTexture(   GL_TEXTURE_2D, texture);
+
+    //Target active unit, level, internalformat, width, height, border, format, type, data
+    texImage2D(texture, GL_TEXTURE_2D, 0, GL_RGB, w, h,
+    	GL_RGB, GL_FLOAT, pixels);
+
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+
+//Sampling state for images that carry a full mip chain
+void trilinear(int levels){
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+//GLUT thread: copy decoded RGB pixels into the unpack buffer and respecify
+//the texture from it
+void uploadTextureImage(GLuint texture, unsigned char* image, int w, int h){
+	GLsizeiptr bytes = (GLsizeiptr)w * h * 3;
+	if (unpackBuffer == 0){
+		genBuffers( MEM_STAGING, 1, &unpackBuffer );
+		labelBuffer(unpackBuffer, "texture unpack");
+	}
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+	//Orphan so a previous upload still being read is never waited on
+	bufferData( unpackBuffer, GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+	void* dst = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (dst){
+		memcpy(dst, image, bytes);
+		glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+
+		glActiveTexture( GL_TEXTURE0);
+		glBindTexture( GL_TEXTURE_2D, texture);
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 1); //RGB rows are not 4-byte padded
+		texImage2D(texture, GL_TEXTURE_2D, 0, GL_RGB, w, h,
+			GL_RGB, GL_UNSIGNED_BYTE, (void*)0);
+		generateMipmap(texture, GL_TEXTURE_2D);
+		trilinear(1 + (int)log2(max(w, h)));
+	}
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+//Read-only mapping of a whole file, unmapped when the last holder lets go
+struct MappedFile {
+	const unsigned char* data = 0;
+	size_t size = 0;
+	~MappedFile(){
+		if (data) munmap((void*)data, size);
+	}
+};
+
+shared_ptr<MappedFile> mapFile(const string &path){
+	shared_ptr<MappedFile> m;
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return m;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0){
+		void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED){
+			m.reset(new MappedFile);
+			m->data = (const unsigned char*)data;
+			m->size = st.st_size;
+		}
+	}
+	close(fd);
+	return m;
+}
+
+//Header of a baked file this GL can upload, or 0
+const BakedHeader* bakedHeader(const MappedFile &m){
+	if (m.size < sizeof(BakedHeader)) return 0;
+	const BakedHeader* h = (const BakedHeader*)m.data;
+	if (h->magic != BAKED_MAGIC || h->version != BAKED_VERSION) return 0;
+	if (h->format > BAKED_BC7 || !bakedFormats[h->format]) return 0;
+	if (h->levels == 0 || h->levels > BAKED_MAX_LEVELS) return 0;
+	if (m.size < sizeof(BakedHeader) + h->levels * sizeof(BakedLevel)) return 0;
+	const BakedLevel* level = (const BakedLevel*)(h + 1);
+	for (uint32_t l = 0; l < h->levels; l++){
+		if (level[l].size != bakedLevelSize(h->format, level[l].width, level[l].height)) return 0;
+		if ((uint64_t)level[l].offset + level[l].size > m.size) return 0;
+	}
+	return h;
+}
+
+//GLUT thread: every level of a baked file, straight from its mapping
+void uploadBaked(GLuint texture, const MappedFile &m){
+	static const GLenum formats[] = { GL_RGBA8,
+		GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+		GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+		GL_COMPRESSED_RGBA_BPTC_UNORM_ARB };
+	const BakedHeader* h = (const BakedHeader*)m.data;
+	const BakedLevel* level = (const BakedLevel*)(h + 1);
+
+	glActiveTexture( GL_TEXTURE0);
+	glBindTexture( GL_TEXTURE_2D, texture);
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1);
+	for (uint32_t l = 0; l < h->levels; l++){
+		const void* pixels = m.data + level[l].offset;
+		if (h->format == BAKED_RGBA8){
+			texImage2D(texture, GL_TEXTURE_2D, l, GL_RGBA8, level[l].width, level[l].height,
+				GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}else{
+			compressedTexImage2D(texture, GL_TEXTURE_2D, l, formats[h->format],
+				level[l].width, level[l].height, level[l].size, pixels);
+		}
+	}
+	trilinear(h->levels);
+}
+
+//Image already holding hash, or a new empty texture registered under it
+int acquireImage(uint64_t hash, bool &created){
+	map<uint64_t, int>::iterator it = textures.byHash.find(hash);
+	if (it != textures.byHash.end()){
+		textures.images[it->second].refs++;
+		created = false;
+		return it->second;
+	}
+	int i;
+	if (!textures.freeImages.empty()){
+		i = textures.freeImages.back();
+		textures.freeImages.pop_back();
+	}else{
+		i = textures.images.size();
+		textures.images.push_back(TextureImage());
+	}
+	TextureImage &im = textures.images[i];
+	genTextures( MEM_STAGING, 1, &im.id );
+	im.hash = hash;
+	im.refs = 1;
+	im.layer = -1;
+	im.ready = false;
+	textures.byHash[hash] = i;
+	created = true;
+	return i;
+}
+
+void releaseImage(int i){
+	TextureImage &im = textures.images[i];
+	if (--im.refs > 0) return;
+	deleteTextures( 1, &im.id );
+	im.id = 0;
+	if (im.layer >= 0) freeLayer(im.layer);
+	im.layer = -1;
+	textures.byHash.erase(im.hash);
+	textures.freeImages.push_back(i);
+}
+
+//Image has its pixels: give it a layer and drop the staging texture. False
+//when the GPU budget leaves no room for another layer.
+bool finishImage(int i){
+	TextureImage &im = textures.images[i];
+	if (im.ready) return true;
+	Trace t("texture layer");
+	DebugGroup g("texture layer");
+	im.layer = allocLayer();
+	if (im.layer < 0) return false;
+	copyToLayer(im.id, im.layer);
+	deleteTextures( 1, &im.id );
+	im.id = 0;
+	im.ready = true;
+	return true;
+}
+
+//Move every slot waiting on image over to it, or back to its placeholder
+//when the file could not be decoded or given a layer
+void settleImage(int image, bool ok){
+	if (ok) ok = finishImage(image);
+	for (size_t s = 0; s < textures.slots.size(); s++){
+		TextureSlot &t = textures.slots[s];
+		if (t.loading != image) continue;
+		if (ok){
+			releaseImage(t.image);
+			t.image = image;
+		}else{
+			releaseImage(image);
+		}
+		t.loading = -1;
+		texturesPending--;
+	}
+}
+
+//Fill image from file on a worker; runs only for content not seen before.
+//Baked files need no decode and go straight to the GLUT thread.
+void decodeImageAsync(int image, uint64_t hash, string path, shared_ptr<MappedFile> file){
+	if (bakedHeader(*file)){
+		Trace t("texture upload");
+		uploadBaked(textures.images[image].id, *file);
+		settleImage(image, true);
+		return;
+	}
+	runAsync([image, hash, path, file]{
+		Trace t("texture decode");
+		int w, h;
+		unsigned char* pixels = SOIL_load_image_from_memory(file->data, file->size, &w, &h, 0, SOIL_LOAD_RGB);
+		runOnMain([image, hash, path, pixels, w, h]{
+			Trace t("texture upload");
+			TextureImage &im = textures.images[image];
+			if (im.refs == 0 || im.hash != hash){ //every slot let go while decoding
+				if (pixels) SOIL_free_image_data(pixels);
+				return;
+			}
+			if (!pixels){
+				cerr << "Could not load texture " << path << endl;
+				settleImage(image, false);
+				return;
+			}
+			uploadTextureImage(im.id, pixels, w, h);
+			SOIL_free_image_data(pixels);
+			settleImage(image, true);
+		});
+	});
+}
+
+//name.png -> name.ltex
+string bakedPath(const string &path){
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of('/');
+	if (dot == string::npos || (slash != string::npos && dot < slash)) return path + ".ltex";
+	return path.substr(0, dot) + ".ltex";
+}
+
+//Map file (or its baked twin) on a worker and hash it. Content already on
+//the GPU, or on its way there, under another path is shared instead of
+//decoded again.
+void loadTextureAsync(int slot, const char* file){
+	string path = file;
+	texturesPending++;
+	runAsync([slot, path]{
+		Trace t("texture read");
+		shared_ptr<MappedFile> mapped = mapFile(bakedPath(path));
+		if (!mapped || !bakedHeader(*mapped)) mapped = mapFile(path);
+		uint64_t hash = mapped ? fnv1a(mapped->data, mapped->size) : 0;
+		runOnMain([slot, path, mapped, hash]{
+			TextureSlot &t = textures.slots[slot];
+			if (!mapped){
+				cerr << "Could not load texture " << path << endl;
+				texturesPending--;
+				return;
+			}
+			bool created;
+			int image = acquireImage(hash, created);
+			t.loading = image;
+			if (created){
+				decodeImageAsync(image, hash, path, mapped);
+			}else if (textures.images[image].ready){
+				settleImage(image, true);
+			}
+			//else another slot is decoding the same bytes and settles this one too
+		});
+	});
+}
+
+//Slot for file, showing the w x h RGB float placeholder until the file has
+//loaded. For "None" the placeholder is the texture, shared with every other
+//identical one.
+int acquireTexture(const char* file, int w, int h, const float* pixels){
+	bool none = strcmp(file, "None") == 0;
+	uint64_t hash = fnv1a(&w, sizeof(w));
+	hash = fnv1a(&h, sizeof(h), hash);
+	hash = fnv1a(pixels, w * h * 3 * sizeof(float), hash);
+
+	string key = file;
+	if (none){
+		char name[20];
+		snprintf(name, sizeof(name), "#%016llx", (unsigned long long)hash);
+		key = name;
+	}
+	map<string, int>::iterator it = textures.byKey.find(key);
+	if (it != textures.byKey.end()) return it->second;
+
+	int s = textures.slots.size();
+	textures.slots.push_back(TextureSlot());
+	TextureSlot &t = textures.slots[s];
+	bool created;
+	t.key = key;
+	t.image = acquireImage(hash, created);
+	t.loading = -1;
+	if (created){
+		initTexture(textures.images[t.image].id, w, h, pixels);
+		finishImage(t.image);
+	}
+	textures.byKey[key] = s;
+
+	if (!none){
+		loadTextureAsync(s, file);
+	}
+	return s;
+}
+
+//https://www.opengl.org/archives/resources/code/samples/glut_examples/examples/examples.html
+
+//float red;
+//float gre;
+//float blu;
+
+//CPU side of a land chunk, built on a worker thread
+struct LandMesh {
+	vector<float> h, H;	//landSample terms at the (ls+1)^2 quad corners
+	vector<float> v;
+	vector<float> cs;	//ridge factor per vertex
+	vector<float> t;
+};
+
+//Rows of corners per sampling job: enough jobs to spread one chunk over
+//the workers
+const int landBandRows = 32;
+
+//Sized up front: a mesh reused for the next chunk keeps its storage
+void sizeLand(LandMesh &m){
+	int corners = (ls + 1) * (ls + 1);
+	m.h.resize(corners);
+	m.H.resize(corners);
+	m.v.resize(ls * ls * 12);
+	m.cs.resize(ls * ls * 4);
+	m.t.resize(ls * ls * 8);
+}
+
+//Corner rows [y0, y1) of the chunk's height grid. Neighbouring quads share
+//corners, so each is sampled once rather than once per quad.
+void sampleLand(LandMesh &m, int chunk_x, int chunk_y, int y0, int y1){
+	float cx = (chunk_x) * ls;
+	float cy = (chunk_y) * ls;
+	for (int y = y0; y < y1; y++){
+		for (int x = 0; x <= ls; x++){
+			int k = y * (ls + 1) + x;
+			landSample(x+cx, y+cy, m.h[k], m.H[k]);
+		}
+	}
+}
+
+//Two triangles per quad, the same for every chunk of a given ls
+void landIndices(vector<unsigned int> &i){
+	int quads = ls * ls;
+	i.resize(quads * 6);
+	for (int c = 0; c < quads; c++){
+		unsigned int* o = &i[c*6];
+		o[0] = 0+c*4; o[1] = 1+c*4; o[2] = 2+c*4;
+		o[3] = 0+c*4; o[4] = 2+c*4; o[5] = 3+c*4;
+	}
+}
+
+//Quads from the sampled height grid
+void buildLand(LandMesh &m){
+	// Create a Plane
+	//  v1------v0----
+	//  |       | 
+	//  |       |
+	//  |       |
+	//  v2------v3---- 
+	//  |       |
+	//  |       |
+
+	float* v = &m.v[0];
+	float* cs = &m.cs[0];
+	float* t = &m.t[0];
+	int c = 0; //count
+	int tex = 1;
+	float s = .1; //size
+	float f = s *.5; //offset
+
+  	for (int y = 0; y < ls; y++){
+		for (int x = 0; x < ls; x++){
+
+			float h[] = {0,0,0,0};
+			float H[] = {0,0,0,0};
+			//Height of the plane corners that make up land
+			for (int it = 0; it < 4; it++){
+				int iy = it % 2;
+				int ix = floor(it/2);
+				int k = (y + iy) * (ls + 1) + x + ix;
+				h[it] = m.h[k];
+				H[it] = m.H[k];
+			}
+			const float quad[] = {
+				f+x*s, h[3]*H[3], f+y*s,
+			   -f+x*s, h[1]*H[1], f+y*s,
+			   -f+x*s, h[0]*H[0], -f+y*s,
+				f+x*s, h[2]*H[2], -f+y*s};
+			memcpy(v + c*12, quad, sizeof(quad));
+			const float uv[] = {(float)tex+x, (float)tex+y,    0.0f+x, (float)tex+y,     0.0f+x, 0.0f+y,   (float)tex+x, 0.0f+y};
+			memcpy(t + c*8, uv, sizeof(uv));
+			
+			float g[] = {0,0,0,0}; //Sharpness of colors on ends of mountains
+			for(int it = 0; it < 4; it++){
+				g[it] = pow(h[it],1); //*.5+.25
+			}
+
+			//Colored by the palette in the shader
+			const float ridge[] = {g[3], g[1], g[0], g[2]};
+			memcpy(cs + c*4, ridge, sizeof(ridge));
+			c += 1;
+		}
+	}
+}
+
+//GL side of a land chunk; must run on the GLUT thread. Every chunk has the
+//same triangles, so the index buffer is passed in and shared.
+void uploadLand(Primitives &o, const LandMesh &m, GLuint indexBuffer, const char* file){
+
+    o.numIndices = ls * ls * 6;
+    o.colorSize = 1;
+    o.indexBuffer = indexBuffer;
+
+    // Create buffer objects
+	genBuffers( MEM_TERRAIN, 1, &o.vertexBuffer );
+	genBuffers( MEM_TERRAIN, 1, &o.colorBuffer );
+	genBuffers( MEM_TERRAIN, 1, &o.texCoordBuffer );
+
+    //Position
+    glBindBuffer( GL_ARRAY_BUFFER, o.vertexBuffer);
+    bufferData( o.vertexBuffer, GL_ARRAY_BUFFER, m.v.size() * sizeof(GLfloat), &m.v[0], GL_STATIC_DRAW);
+
+    //Ridge
+    glBindBuffer( GL_ARRAY_BUFFER, o.colorBuffer);
+    bufferData( o.colorBuffer, GL_ARRAY_BUFFER, m.cs.size() * sizeof(GLfloat), &m.cs[0], GL_STATIC_DRAW);
+
+	//Texture Coordinates
+    glBindBuffer( GL_ARRAY_BUFFER, o.texCoordBuffer);
+    bufferData( o.texCoordBuffer, GL_ARRAY_BUFFER, m.t.size() * sizeof(GLfloat), &m.t[0], GL_STATIC_DRAW);
+
+    //Bind Texture, placeholder until a file arrives
+    glEnable(GL_TEXTURE_2D);
+	float pixels[] = {
+		1.0f, .9f, 1.0f,   .9f, 1.0f, .9f,
+		1.0f, .9f, .9f,   .9f, .9f, 1.0f,
+	};
+	o.texture = acquireTexture(file, 2, 2, pixels);
+
+    //No Buffer Bound
+	glBindBuffer( GL_ARRAY_BUFFER, 0);
+}
+
+//Overwrite all of buffer, which already has data's size. Invalidating the
+//whole range lets the driver hand back fresh storage instead of waiting
+//for draws still reading the old contents.
+void refillBuffer(GLuint buffer, const vector<float> &data){
+	GLsizeiptr bytes = data.size() * sizeof(float);
+	glBindBuffer( GL_ARRAY_BUFFER, buffer);
+	void* dst = glMapBufferRange( GL_ARRAY_BUFFER, 0, bytes,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	bool ok = dst != 0;
+	if (dst){
+		memcpy(dst, &data[0], bytes);
+		ok = glUnmapBuffer( GL_ARRAY_BUFFER ) == GL_TRUE;
+	}
+	if (!ok) glBufferSubData( GL_ARRAY_BUFFER, 0, bytes, &data[0]);
+	glBindBuffer( GL_ARRAY_BUFFER, 0);
+}
+
+//Put another chunk's mesh into land buffers made by uploadLand
+void refillLand(Primitives &o, const LandMesh &m){
+	refillBuffer(o.vertexBuffer, m.v);
+	refillBuffer(o.colorBuffer, m.cs);
+	refillBuffer(o.texCoordBuffer, m.t);
+}
+
+void labelPrimitive(const Primitives &o, const string &name){
+	labelBuffer(o.vertexBuffer, name + " positions");
+	labelBuffer(o.colorBuffer, name + " colors");
+	labelBuffer(o.indexBuffer, name + " indices");
+	labelBuffer(o.texCoordBuffer, name + " texcoords");
+}
+
+//Bytes of o's buffers; its texture is a layer shared through the cache
+long primitiveBytes(const Primitives &o){
+	return bufferBytes(o.vertexBuffer) + bufferBytes(o.colorBuffer) +
+		bufferBytes(o.indexBuffer) + bufferBytes(o.texCoordBuffer);
+}
+
+
+void initPlane(Primitives &o, const char* file){
+	// Create a Plane
+	//  v1------v0
 	//  |       | 
 	//  |       |
 	//  |       |
 	//  v2------v3
 
-    const GLfloat vertices[] = {
-     //  X   Y  Z
-		.5, .5,  0,  -.5, .5,  0,  -.5,-.5,  0,   .5,-.5,  0,  
-    };
+    const GLfloat vertices[] = {
+     //  X   Y  Z
+		.5, .5,  0,  -.5, .5,  0,  -.5,-.5,  0,   .5,-.5,  0,  
+    };
+
+    const GLfloat colors[] = {
+     // R, G, B, A,
+        1, 1, 0, 1,
+        0, 1, 0, 1, 
+        0, 0, 1, 1,
+
+        1, 1, 0, 1, 
+        0, 0, 1, 1, 
+        1, 1, 1, 1,
+    };
+
+    float n = 5;
+    const GLfloat texCoords[] = {
+		0.0, 0.0,   n,0.0,   n,n,   0.0, n  // v0-v5-v6-v1 up
+    };
+
+    const GLuint indices[] = {
+		 0, 1, 2,   0, 2, 3,    // front 
+    };
+
+    o.numIndices = sizeof(indices) / 4;
+    o.colorSize = 4;
+
+    // Create buffer objects
+	genBuffers( MEM_PROPS, 1, &o.vertexBuffer );
+	genBuffers( MEM_PROPS, 1, &o.colorBuffer );
+	genBuffers( MEM_PROPS, 1, &o.indexBuffer );
+	genBuffers( MEM_PROPS, 1, &o.texCoordBuffer );
+
+    //Position
+    glBindBuffer( GL_ARRAY_BUFFER, o.vertexBuffer);
+    bufferData( o.vertexBuffer, GL_ARRAY_BUFFER, sizeof(vertices), &vertices[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(a_Position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(a_Position);
+
+    //Color
+    glBindBuffer( GL_ARRAY_BUFFER, o.colorBuffer);
+    bufferData( o.colorBuffer, GL_ARRAY_BUFFER, sizeof(colors), &colors[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(a_Color, 4, GL_FLOAT, GL_FALSE, 0, 0 );
+    glEnableVertexAttribArray(a_Color);
+
+    //Index Buffer
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, o.indexBuffer);
+    bufferData( o.indexBuffer, GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), &indices[0], GL_STATIC_DRAW);
+
+	//Texture Coordinates
+    glBindBuffer( GL_ARRAY_BUFFER, o.texCoordBuffer);
+    bufferData( o.texCoordBuffer, GL_ARRAY_BUFFER, sizeof(texCoords), &texCoords[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(a_TexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(a_TexCoord);
+
+    //Bind Texture, placeholder until a file arrives
+    glEnable(GL_TEXTURE_2D);
+	int c = 24;
+	float pixels[c*c*3];
+	for (int i = 0; i < c*c*3; i++){
+		pixels[i] = 1.0f;
+	}
+	o.texture = acquireTexture(file, c, c, pixels);
+
+    //No Buffer Bound
+	glBindBuffer( GL_ARRAY_BUFFER, 0);
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void initCube(Primitives &o, const char* file) {
+	// Create a cube
+	//    v6----- v5
+	//   /|      /|
+	//  v1------v0|
+	//  | |     | |
+	//  | |v7---|-|v4
+	//  |/      |/
+	//  v2------v3
+
+	const GLfloat vertices[] = {
+	    /*X,  Y,  Z  */
+		 .5, .5, .5,  -.5, .5, .5,  -.5,-.5, .5,   .5,-.5, .5,  
+		 .5, .5, .5,   .5,-.5, .5,   .5,-.5,-.5,   .5, .5,-.5,
+		 .5, .5, .5,   .5, .5,-.5,  -.5, .5,-.5,  -.5, .5, .5,
+		-.5, .5, .5,  -.5, .5,-.5,  -.5,-.5,-.5,  -.5,-.5, .5, 
+		-.5,-.5,-.5,   .5,-.5,-.5,   .5,-.5, .5,  -.5,-.5, .5, 
+		 .5,-.5,-.5,  -.5,-.5,-.5,  -.5, .5,-.5,   .5, .5,-.5 
+    };
+
+    float n = 3;
+    const GLfloat texCoords[] = {
+		1.0, 1.0,   0.0, 1.0,   0.0, 0.0,   1.0, 0.0,    // v0-v1-v2-v3 front
+		0.0, 1.0,   0.0, 0.0,   1.0, 0.0,   1.0, 1.0,    // v0-v3-v4-v5 right
+		n,   0.0,   n,n,        0.0, n,     0.0, 0.0,    // v0-v5-v6-v1 up
+		1.0, 1.0,   0.0, 1.0,   0.0, 0.0,   1.0, 0.0,    // v1-v6-v7-v2 left
+		0.0, 0.0,   1.0, 0.0,   1.0, 1.0,   0.0, 1.0,    // v7-v4-v3-v2 down
+		0.0, 0.0,   1.0, 0.0,   1.0, 1.0,   0.0, 1.0     // v4-v7-v6-v5 back
+    };
+
+    const GLfloat colors[] = {
+     /* R,   G,   B,  A, */
+	    0.1, 0.1, 1.0,1,  0.1, 0.1, 1.0,1,  0.1, 0.1, 1.0,1,  0.1, 0.1, 1.0,1,
+	    0.1, 1.0, 0.1,1,  0.1, 1.0, 0.1,1,  0.1, 1.0, 0.1,1,  0.1, 1.0, 0.1,1,
+	    1.0, 0.1, 0.1,1,  1.0, 0.1, 0.1,1,  1.0, 0.1, 0.1,1,  1.0, 0.1, 0.1,1,
+	    1.0, 1.0, 0.1,1,  1.0, 1.0, 0.1,1,  1.0, 1.0, 0.1,1,  1.0, 1.0, 0.1,1,
+	    1.0, 1.0, 1.0,1,  1.0, 1.0, 1.0,1,  1.0, 1.0, 1.0,1,  1.0, 1.0, 1.0,1,
+	    0.1, 1.0, 1.0,1,  0.1, 1.0, 1.0,1,  0.1, 1.0, 1.0,1,  0.1, 1.0, 1.0,1
+    };
+
+    const GLuint indices[] = {
+		 0, 1, 2,   0, 2, 3,    // front
+		 4, 5, 6,   4, 6, 7,    // right
+		 8, 9,10,   8,10,11,    // up
+		12,13,14,  12,14,15,    // left
+		16,17,18,  16,18,19,    // down
+		20,21,22,  20,22,23     // back    	
+    };
+  
+    o.numIndices = sizeof(indices) / 4;
+    o.colorSize = 4;
+
+    // Create buffer objects
+	genBuffers( MEM_PROPS, 1, &o.vertexBuffer );
+	genBuffers( MEM_PROPS, 1, &o.colorBuffer );
+	genBuffers( MEM_PROPS, 1, &o.indexBuffer );
+	genBuffers( MEM_PROPS, 1, &o.texCoordBuffer );
+
+    //Position
+    glBindBuffer( GL_ARRAY_BUFFER, o.vertexBuffer);
+    bufferData( o.vertexBuffer, GL_ARRAY_BUFFER, sizeof(vertices), &vertices[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(a_Position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(a_Position);
+
+    //Color
+    glBindBuffer( GL_ARRAY_BUFFER, o.colorBuffer);
+    bufferData( o.colorBuffer, GL_ARRAY_BUFFER, sizeof(colors), &colors[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(a_Color, 4, GL_FLOAT, GL_FALSE, 0, 0 );
+    glEnableVertexAttribArray(a_Color);
+
+    //Texture Coordinates
+    glBindBuffer( GL_ARRAY_BUFFER, o.texCoordBuffer);
+    bufferData( o.texCoordBuffer, GL_ARRAY_BUFFER, sizeof(texCoords), &texCoords[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(a_TexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(a_TexCoord);
+
+    //Bind Texture, placeholder until a file arrives
+    float pixels[] = {
+    	1.0f, 1.0f, 1.0f,   0.0f, 0.0f, 0.0f,
+    	0.0f, 0.0f, 0.0f,   1.0f, 1.0f, 1.0f,
+    };
+	o.texture = acquireTexture(file, 2, 2, pixels);
+
+    //Index Buffer
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, o.indexBuffer);
+    bufferData( o.indexBuffer, GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), &indices[0], GL_STATIC_DRAW);
+
+    //No Buffer Bound
+	glBindBuffer( GL_ARRAY_BUFFER, 0);
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0);
+
+}
+
+
+
+
+Matrix4 viewMatrix;
+Matrix4 projMatrix;
+Matrix4 modelMatrix;
+
+SceneGraph scene;
+int cubeNode, planeNode, landNode;
+
+//Land chunks hang off one scaled root; chunk nodes are added as they stream in
+void initScene(){
+	int rrr = SEED % 2;
+	if (rrr == 0) rrr = 2;
+	int s = 48;
+
+	cubeNode = scene.add();
+	planeNode = scene.add();
+
+	landNode = scene.add();
+	scene.edit(landNode).setScale(s,rrr,s);
+	scene.update();
+}
+
+//Vertex attributes, texture and indices of o
+void bindPrimitive(Primitives &o){
+
+	//Activate Vertex Coordinates
+    glBindBuffer( GL_ARRAY_BUFFER, o.vertexBuffer);
+    glVertexAttribPointer(a_Position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(a_Position);
+
+  	//Activate Color Coordinates, or the ridge factor the palette colors
+	glBindBuffer( GL_ARRAY_BUFFER, o.colorBuffer);
+	if (o.colorSize == 1){
+		glVertexAttribPointer(a_Ridge, 1, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(a_Ridge);
+		glDisableVertexAttribArray(a_Color);
+		glVertexAttrib4f(a_Color, 1, 1, 1, 1);
+	}else{
+		glVertexAttribPointer(a_Color, 4, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(a_Color);
+		glDisableVertexAttribArray(a_Ridge);
+	}
+
+	//Activate Texture Coordinates
+	glBindBuffer( GL_ARRAY_BUFFER, o.texCoordBuffer);
+	glVertexAttribPointer(a_TexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(a_TexCoord);
+
+	//Bind Indices
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, o.indexBuffer);
+}
+
+//Counted by render() and renderProps(), reset every frame
+struct FrameStats {
+	int draws = 0;
+	long triangles = 0;
+	int chunksDrawn = 0;
+} frameStats;
+
+void render(Primitives &o){
+	bindPrimitive(o);
+
+	//Update uniforms in frag vertex  //1 denotes number of matrixes to update
+    glUniformMatrix4fv( u.ViewMatrix, 1, GL_TRUE, viewMatrix.elements);
+    glUniformMatrix4fv( u.ProjMatrix, 1, GL_TRUE, projMatrix.elements);
+    glUniformMatrix4fv( u.ModelMatrix, 1, GL_TRUE, modelMatrix.elements);
+    glUniform1i( u.Sampler, 0);
+    glUniform1f( u.Layer, textureLayer(o.texture));
+    glUniform1i( u.Paletted, o.colorSize == 1);
+
+    //DrawElements allows to display Cube, etc, with fewer indices
+    glDrawElements( GL_TRIANGLES, o.numIndices, GL_UNSIGNED_INT, 0);
+    frameStats.draws++;
+    frameStats.triangles += o.numIndices / 3;
+}
+
+/////////////////////Props
+//Rocks, pillars and spinning cubes scattered over the land. Each batch is a
+//shared mesh plus per-instance matrices (from a TransformSoA) and colors, and
+//draws with one glDrawElementsInstanced however many instances it holds.
+
+struct PropBatch {
+	Primitives* mesh;
+	int texture;
+	GLuint matrixBuffer;
+	GLuint colorBuffer;
+	TransformSoA transforms;
+	vector<float> colors;
+	bool animated = false;	//spins every frame
+	bool dirty = true;	//matrices need uploading
+};
+
+PropBatch rocks, pillars, spinners;
+
+//Deterministic 0..1 value for (a, b) under the current SEED
+float hashUnit(int a, int b, int salt){
+	unsigned int h = SEED * 374761393u + a * 668265263u + b * 2246822519u + salt * 3266489917u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	h ^= h >> 16;
+	return (h & 0xffffff) / 16777216.0f;
+}
+
+//Small deterministic generator for per-chunk sampling
+struct Rng {
+	unsigned int state;
+	Rng(unsigned int seed) : state(seed ? seed : 1) {}
+	float next(){
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state & 0xffffff) / 16777216.0f;
+	}
+};
+
+//Bridson Poisson-disk sampling in [margin, size - margin]^2 with minimum
+//distance r. A margin of r/2 keeps samples from neighbouring chunks at least
+//r apart as well, so chunks never need to look at each other.
+//Per-worker scratch for scattering, kept between chunks so sampling one
+//allocates nothing once it has seen a chunk
+struct ScatterScratch {
+	vector<int> grid;
+	vector<int> active;
+	vector<float> pts;
+};
+thread_local ScatterScratch scatterScratch;
+
+void poissonDisk(float size, float r, Rng &rng, vector<float> &out){
+	const int k = 20;
+	float margin = r * .5;
+	float lo = margin, hi = size - margin;
+	float cell = r / sqrt(2.0);
+	int n = (int)ceil(size / cell);
+	vector<int> &grid = scatterScratch.grid;
+	vector<int> &active = scatterScratch.active;
+	grid.assign(n * n, -1);
+	active.clear();
+	//At most one sample per cell
+	active.reserve(n * n);
+	out.clear();
+	out.reserve(n * n * 2);
+	out.push_back(lo + rng.next() * (hi - lo));
+	out.push_back(lo + rng.next() * (hi - lo));
+	grid[(int)(out[1] / cell) * n + (int)(out[0] / cell)] = 0;
+	active.push_back(0);
+
+	while (!active.empty()){
+		int a = rng.next() * active.size();
+		float ax = out[active[a]*2], ay = out[active[a]*2+1];
+		bool found = false;
+		for (int attempt = 0; attempt < k && !found; attempt++){
+			float angle = rng.next() * 2 * M_PI;
+			float dist = r * (1 + rng.next());
+			float px = ax + cos(angle) * dist;
+			float py = ay + sin(angle) * dist;
+			if (px < lo || px > hi || py < lo || py > hi) continue;
+			int gx = px / cell, gy = py / cell;
+			bool ok = true;
+			for (int y = max(gy-2, 0); y <= min(gy+2, n-1) && ok; y++){
+				for (int x = max(gx-2, 0); x <= min(gx+2, n-1); x++){
+					int o = grid[y*n + x];
+					if (o < 0) continue;
+					float dx = out[o*2] - px, dy = out[o*2+1] - py;
+					if (dx*dx + dy*dy < r*r){ ok = false; break; }
+				}
+			}
+			if (!ok) continue;
+			int idx = out.size() / 2;
+			out.push_back(px);
+			out.push_back(py);
+			grid[gy*n + gx] = idx;
+			active.push_back(idx);
+			found = true;
+		}
+		if (!found){
+			active[a] = active.back();
+			active.pop_back();
+		}
+	}
+}
+
+enum { PROP_ROCK, PROP_PILLAR, PROP_SPINNER };
+
+//One scattered prop, as produced on a worker for its chunk
+struct PropInstance {
+	int kind;
+	float p[3];
+	float scale[3];
+	float rotate[4];	//angle (degrees), axis
+	float spin[4];
+	float color[4];	//ridge, brightness, invert, alpha; see shaders/props.vert
+};
+
+//Land grid point (X, Y) at height e to world space, through the land root
+//matrix (passed in so workers never touch the scene graph)
+void landToWorld(const Matrix4 &root, float X, float Y, float e, float* out){
+	const float* m = root.elements;
+	float lx = (X-ls)*.1 - .05;
+	float ly = e - 8;
+	float lz = (Y-ls)*.1 - .05;
+	out[0] = m[0]*lx + m[4]*ly + m[8]*lz  + m[12];
+	out[1] = m[1]*lx + m[5]*ly + m[9]*lz  + m[13];
+	out[2] = m[2]*lx + m[6]*ly + m[10]*lz + m[14];
+}
+
+//Blue-noise placement over one chunk, driven by the land's height and slope.
+//Runs on a worker; deterministic for (SEED, chunk_x, chunk_y).
+void scatterProps(vector<PropInstance> &props, const Matrix4 &root, int chunk_x, int chunk_y){
+	Rng rng(hashUnit(chunk_x, chunk_y, 7) * 4294967295.0);
+	vector<float> &pts = scatterScratch.pts;
+	poissonDisk(ls, 5, rng, pts);
+	props.reserve(scatterScratch.grid.size());
+
+	//World units per grid step horizontally, and the vertical land scale
+	float across = root.elements[0] * .1;
+	float up = root.elements[5];
+
+	for (size_t n = 0; n < pts.size(); n += 2){
+		float X = chunk_x*ls + pts[n];
+		float Y = chunk_y*ls + pts[n+1];
+		float kind = rng.next();
+		float vary = rng.next();
+
+		float ridge;
+		float e = landSurface(X, Y, &ridge);
+		float dx = landSurface(X + .5, Y) - landSurface(X - .5, Y);
+		float dy = landSurface(X, Y + .5) - landSurface(X, Y - .5);
+		float slope = sqrt(dx*dx + dy*dy) * up / across;
+		if (slope > 1.2) continue; //nothing clings to cliffs
+
+		PropInstance o;
+		landToWorld(root, X, Y, e, o.p);
+
+		//Tinted like the land beneath them, through the palette
+		o.spin[0] = 0; o.spin[1] = 0; o.spin[2] = 1; o.spin[3] = 0;
+		o.color[0] = ridge;
+		o.color[2] = 0;
+		o.color[3] = 1;
+
+		if (ridge > .45 && slope < .5 && kind < .25){
+			float height = 10 + vary * 15;
+			o.kind = PROP_PILLAR;
+			o.p[1] += height * .5 - 1;
+			o.scale[0] = 2; o.scale[1] = height; o.scale[2] = 2;
+			o.rotate[0] = vary * 90; o.rotate[1] = 0; o.rotate[2] = 1; o.rotate[3] = 0;
+			o.color[1] = 1.2;
+		}else if (ridge > .6 && kind > .92){
+			o.kind = PROP_SPINNER;
+			o.p[1] += 8 + vary * 6;
+			o.scale[0] = o.scale[1] = o.scale[2] = 2.5;
+			o.rotate[0] = 0; o.rotate[1] = 0; o.rotate[2] = 1; o.rotate[3] = 0;
+			o.spin[0] = 1 + vary * 3; o.spin[1] = 1*sin(X*.01); o.spin[2] = 1; o.spin[3] = 0;
+			o.color[1] = 1; o.color[2] = 1;
+		}else if (kind < .6){
+			//Rocks flatten out on steeper ground
+			float size = 1.5 + vary * 2.5;
+			o.kind = PROP_ROCK;
+			o.p[1] += size * .2;
+			o.scale[0] = size; o.scale[1] = size * (.6 - slope * .2); o.scale[2] = size;
+			o.rotate[0] = vary * 360; o.rotate[1] = kind; o.rotate[2] = 1; o.rotate[3] = vary;
+			o.color[1] = .6;
+		}else{
+			continue;
+		}
+		props.push_back(o);
+	}
+}
+
+void initPropBatch(PropBatch &b, Primitives* mesh, int texture, bool animated){
+	b.mesh = mesh;
+	b.texture = texture;
+	b.animated = animated;
+	genBuffers( MEM_PROPS, 1, &b.matrixBuffer );
+	genBuffers( MEM_PROPS, 1, &b.colorBuffer );
+}
+
+void uploadPropColors(PropBatch &b){
+	glBindBuffer( GL_ARRAY_BUFFER, b.colorBuffer);
+	bufferData( b.colorBuffer, GL_ARRAY_BUFFER, b.colors.size() * sizeof(float),
+		b.colors.empty() ? 0 : &b.colors[0], GL_STATIC_DRAW);
+	glBindBuffer( GL_ARRAY_BUFFER, 0);
+}
+
+void initProps(){
+	//Untextured: the plane's plain white texture
+	initPropBatch(rocks, &oneCube, onePlane.texture, false);
+	initPropBatch(pillars, &oneCube, onePlane.texture, false);
+	initPropBatch(spinners, &oneCube, onePlane.texture, true);
+	const char* names[3] = { "rocks", "pillars", "spinners" };
+	PropBatch* batches[3] = { &rocks, &pillars, &spinners };
+	for (int k = 0; k < 3; k++){
+		labelBuffer(batches[k]->matrixBuffer, string(names[k]) + " matrices");
+		labelBuffer(batches[k]->colorBuffer, string(names[k]) + " colors");
+	}
+}
+
+//Refill the batches from the props of every resident chunk. Runs only when a
+//chunk streams in or out, never per frame.
+void rebuildProps(const vector<const vector<PropInstance>*> &lists){
+	PropBatch* batches[3] = { &rocks, &pillars, &spinners };
+	for (int k = 0; k < 3; k++){
+		batches[k]->transforms.clear();
+		batches[k]->colors.clear();
+	}
+	for (size_t l = 0; l < lists.size(); l++){
+		const vector<PropInstance> &props = *lists[l];
+		for (size_t n = 0; n < props.size(); n++){
+			const PropInstance &o = props[n];
+			PropBatch &b = *batches[o.kind];
+			int i = b.transforms.add(o.p[0], o.p[1], o.p[2]);
+			b.transforms.setScale(i, o.scale[0], o.scale[1], o.scale[2]);
+			b.transforms.setRotate(i, o.rotate[0], o.rotate[1], o.rotate[2], o.rotate[3]);
+			b.transforms.setSpin(i, o.spin[0], o.spin[1], o.spin[2], o.spin[3]);
+			b.colors.insert(b.colors.end(), o.color, o.color + 4);
+		}
+	}
+	for (int k = 0; k < 3; k++){
+		uploadPropColors(*batches[k]);
+		batches[k]->dirty = true;
+	}
+}
+
+void renderProps(PropBatch &b){
+	int count = b.transforms.count;
+	if (count == 0) return;
+
+	if (b.animated){
+		spinTransforms(b.transforms);
+		b.dirty = true;
+	}
+	glBindBuffer( GL_ARRAY_BUFFER, b.matrixBuffer);
+	if (b.dirty){
+		//Orphan and refill so the driver never waits on last frame's draw
+		GLsizeiptr bytes = count * 16 * sizeof(float);
+		bufferData( b.matrixBuffer, GL_ARRAY_BUFFER, bytes, NULL, b.animated ? GL_STREAM_DRAW : GL_STATIC_DRAW);
+		float* dst = (float*)glMapBufferRange( GL_ARRAY_BUFFER, 0, bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (dst){
+			updateTransforms(b.transforms, dst);
+			glUnmapBuffer( GL_ARRAY_BUFFER );
+			b.dirty = false;
+		}
+	}
+
+	//Per-instance model matrix, one vec4 attribute per column
+	for (int c = 0; c < 4; c++){
+		glVertexAttribPointer(a_InstanceMatrix + c, 4, GL_FLOAT, GL_FALSE,
+			16 * sizeof(float), (void*)(c * 4 * sizeof(float)));
+		glVertexAttribDivisor(a_InstanceMatrix + c, 1);
+		glEnableVertexAttribArray(a_InstanceMatrix + c);
+	}
+	glBindBuffer( GL_ARRAY_BUFFER, b.colorBuffer);
+	glVertexAttribPointer(a_InstanceColor, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	glVertexAttribDivisor(a_InstanceColor, 1);
+	glEnableVertexAttribArray(a_InstanceColor);
+
+	bindPrimitive(*b.mesh);
+	glUniform1f( ui.Layer, textureLayer(b.texture));
+
+	glDrawElementsInstanced( GL_TRIANGLES, b.mesh->numIndices, GL_UNSIGNED_INT, 0, count);
+	frameStats.draws++;
+	frameStats.triangles += (long)b.mesh->numIndices / 3 * count;
+
+	//Plain render() calls must not fetch instance attributes
+	for (int c = 0; c < 4; c++){
+		glDisableVertexAttribArray(a_InstanceMatrix + c);
+	}
+	glDisableVertexAttribArray(a_InstanceColor);
+}
+
+//All props with the instanced program; draw calls stay at one per batch
+void renderAllProps(){
+	Trace t("props");
+	GpuTrace g("props (gpu)");
+	DebugGroup group("props");
+	glUseProgram( instanceProgram );
+    glUniformMatrix4fv( ui.ViewMatrix, 1, GL_TRUE, viewMatrix.elements);
+    glUniformMatrix4fv( ui.ProjMatrix, 1, GL_TRUE, projMatrix.elements);
+    glUniform1i( ui.Sampler, 0);
+	glUniform1f( ui.Time, u.Tx );
+	uploadPalette(ui);
+
+	renderProps(rocks);
+	renderProps(pillars);
+	renderProps(spinners);
+
+	glUseProgram( program );
+}
+
+/////////////////////Chunks
+//Land streams in around the player. Each chunk's mesh and props are built
+//together on a worker, uploaded on the GLUT thread into a slot of the chunk
+//pool, and let go of together when the player moves away.
+
+//GPU buffers for one chunk mesh. Every chunk has the same layout for a
+//given ls, so any slot fits any chunk and they all share one index buffer.
+//A slot whose chunk left view keeps its mesh (and props) until it is
+//recycled, least recently used first, so coming back costs no rebuild.
+struct ChunkSlot {
+	Primitives land;
+	int index;
+	bool allocated = false;	//land's buffers exist
+	bool filled = false;	//holds chunk (cx, cy)
+	bool active = false;	//owned by a Chunk, resident or on its way
+	int cx, cy;
+	vector<PropInstance> props;
+	unsigned long used = 0;	//updateChunks pass it was last active in
+};
+
+//Slots are never deleted while streaming: eviction just marks them
+//inactive, and refilling one orphans its storage rather than syncing.
+//The pool grows while --chunk-pool and the GPU budget leave room.
+struct ChunkPool {
+	vector<ChunkSlot*> slots;
+	GLuint indices = 0;
+	float budgetMB = 128;	//--chunk-pool
+	unsigned long clock = 0;
+	int reused = 0;	//chunks brought back without a rebuild
+} chunkPool;
+
+//Vertex data of one chunk: 4 corners of position, texcoord and ridge per quad
+long slotBytes(){
+	return (long)ls * ls * 4 * (3 + 2 + 1) * sizeof(float);
+}
+
+//An inactive slot still holding chunk (cx, cy)
+ChunkSlot* cachedSlot(int cx, int cy){
+	for (size_t k = 0; k < chunkPool.slots.size(); k++){
+		ChunkSlot* s = chunkPool.slots[k];
+		if (!s->active && s->filled && s->cx == cx && s->cy == cy) return s;
+	}
+	return 0;
+}
+
+//A slot for a new chunk: an empty one, a new one while there is room, or
+//else the least recently used. 0 when every slot is in use and the pool
+//cannot grow.
+ChunkSlot* acquireSlot(){
+	ChunkSlot* lru = 0;
+	for (size_t k = 0; k < chunkPool.slots.size(); k++){
+		ChunkSlot* s = chunkPool.slots[k];
+		if (s->active) continue;
+		if (!s->filled){ lru = s; break; }
+		if (!lru || s->used < lru->used) lru = s;
+	}
+	if (!lru || lru->filled){
+		long grown = (long)(chunkPool.slots.size() + 1) * slotBytes();
+		bool room = chunkPool.slots.empty() || grown <= chunkPool.budgetMB * 1048576;
+		if (room && gpuBudgetAllows(slotBytes(), "land")){
+			lru = new ChunkSlot;
+			lru->index = chunkPool.slots.size();
+			chunkPool.slots.push_back(lru);
+		}
+	}
+	if (!lru) return 0;
+	lru->active = true;
+	lru->filled = false;
+	lru->props.clear();
+	return lru;
+}
+
+void releaseSlot(ChunkSlot* s){
+	s->active = false;
+	s->used = chunkPool.clock;
+}
+
+//GLUT thread: put mesh into s, making its buffers the first time
+void fillSlot(ChunkSlot* s, const LandMesh &mesh){
+	if (chunkPool.indices == 0){
+		vector<unsigned int> i;
+		landIndices(i);
+		genBuffers( MEM_TERRAIN, 1, &chunkPool.indices );
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, chunkPool.indices);
+		bufferData( chunkPool.indices, GL_ELEMENT_ARRAY_BUFFER, i.size() * sizeof(GLuint), &i[0], GL_STATIC_DRAW);
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	if (s->allocated){
+		refillLand(s->land, mesh);
+	}else{
+		uploadLand(s->land, mesh, chunkPool.indices, "None");
+		labelPrimitive(s->land, "chunk slot " + to_string(s->index));
+		labelBuffer(chunkPool.indices, "chunk indices");
+		s->allocated = true;
+	}
+}
+
+//One chunk build in flight. Owned by its worker jobs until it is handed back
+//to finishChunk, which returns it to the pool; evicting a chunk only sets
+//cancelled.
+struct ChunkJob {
+	int cx, cy;
+	atomic<bool> cancelled;
+	Matrix4 root;
+	LandMesh mesh;
+	vector<PropInstance> props;
+	vector<Job*> graph;	//pooled: height bands, then mesh, props and finish
+	function<void()> done;	//run by finish
+};
 
-    const GLfloat colors[] = {
-     // R, G, B, A,
-        1, 1, 0, 1,
-        0, 1, 0, 1, 
-        0, 0, 1, 1,
+//Finished jobs keep their mesh and props storage and their job graph for the
+//next build, so once there is one per build in flight a chunk build never
+//allocates
+struct ChunkJobPool {
+	mutex lock;
+	vector<ChunkJob*> free;
+} chunkJobs;
+
+ChunkJob* takeJob(){
+	lock_guard<mutex> hold(chunkJobs.lock);
+	if (chunkJobs.free.empty()) return new ChunkJob;
+	ChunkJob* job = chunkJobs.free.back();
+	chunkJobs.free.pop_back();
+	return job;
+}
 
-        1, 1, 0, 1, 
-        0, 0, 1, 1, 
-        1, 1, 1, 1,
-    };
+void returnJob(ChunkJob* job){
+	job->props.clear();
+	lock_guard<mutex> hold(chunkJobs.lock);
+	chunkJobs.free.push_back(job);
+}
 
-    float n = 5;
-    const GLfloat texCoords[] = {
-		0.0, 0.0,   n,0.0,   n,n,   0.0, n  // v0-v5-v6-v1 up
-    };
+//The same as jobs for the workers: height bands -> mesh, with props
+//alongside, then done. All of them at priority. The jobs are made by the
+//job's first build and rearmed by the later ones.
+void submitChunk(ChunkJob* job, float priority, function<void()> done){
+	sizeLand(job->mesh);
+	job->done = move(done);
+	vector<Job*> &g = job->graph;
+	if (g.empty()){
+		for (int y = 0; y <= ls; y += landBandRows){
+			int y1 = min(y + landBandRows, ls + 1);
+			g.push_back(newJob([job, y, y1]{
+				if (job->cancelled) return;
+				Trace t("chunk heights");
+				sampleLand(job->mesh, job->cx, job->cy, y, y1);
+			}));
+		}
+		g.push_back(newJob([job]{
+			if (job->cancelled) return;
+			Trace t("chunk mesh");
+			buildLand(job->mesh);
+		}));
+		g.push_back(newJob([job]{
+			if (job->cancelled) return;
+			Trace t("chunk props");
+			scatterProps(job->props, job->root, job->cx, job->cy);
+		}));
+		//Moved out first: done may hand the job back, and it be resubmitted
+		g.push_back(newJob([job]{
+			function<void()> done;
+			done.swap(job->done);
+			done();
+		}));
+		for (size_t k = 0; k < g.size(); k++) g[k]->pooled = true;
+	}
+	size_t bands = g.size() - 3;
+	Job* mesh = g[bands];
+	Job* props = g[bands + 1];
+	Job* finish = g[bands + 2];
+	for (size_t k = 0; k < g.size(); k++) rearmJob(g[k], priority);
+	jobAfter(finish, mesh);
+	jobAfter(finish, props);
+	for (size_t k = 0; k < bands; k++) jobAfter(mesh, g[k]);
+	for (size_t k = 0; k < bands; k++) submitJob(g[k]);
+	submitJob(props);
+	submitJob(mesh);
+	submitJob(finish);
+}
 
-    const GLuint indices[] = {
-		 0, 1, 2,   0, 2, 3,    // front 
-    };
+struct Chunk {
+	int cx, cy;
+	bool resident = false;
+	ChunkJob* job = 0;
+	ChunkSlot* slot = 0;
+	int node = -1;
+};
 
-    o.numIndices = sizeof(indices) / 4;
+vector<Chunk*> chunks;
+float viewDistance = 0;	//grid units from the player to a chunk's edge; 0: ls
+int maxChunks = 16;
+bool propsDirty = false;
 
-    // Create buffer objects
-	glGenBuffers( 1, &o.vertexBuffer);
-	glGenBuffers( 1, &o.colorBuffer );
-	glGenBuffers( 1, &o.indexBuffer );
-	glGenBuffers( 1, &o.texCoordBuffer );
-	glGenTextures( 1, &o.textureID );
+Chunk* findChunk(int cx, int cy){
+	for (size_t k = 0; k < chunks.size(); k++){
+		if (chunks[k]->cx == cx && chunks[k]->cy == cy) return chunks[k];
+	}
+	return 0;
+}
 
-    //Position
-    glBindBuffer( GL_ARRAY_BUFFER, o.vertexBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(vertices), &vertices[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_Position, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(a_Position);
+//Slot filled: place it in the scene
+void showChunk(Chunk* c){
+	c->node = scene.add(landNode);
+	scene.edit(c->node).setTranslate((c->cx-1)*ls*.1, -8, (c->cy-1)*ls*.1);
+	c->resident = true;
+	propsDirty = true;
+}
 
-    //Color
-    glBindBuffer( GL_ARRAY_BUFFER, o.colorBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(colors), &colors[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_Color, 4, GL_FLOAT, GL_FALSE, 0, 0 );
-    glEnableVertexAttribArray(a_Color);
+void finishChunk(ChunkJob* job){
+	Chunk* c = job->cancelled ? 0 : findChunk(job->cx, job->cy);
+	if (!c || c->job != job){
+		returnJob(job);
+		return;
+	}
+	Trace t("chunk upload");
+	fillSlot(c->slot, job->mesh);
+	c->slot->filled = true;
+	c->slot->cx = c->cx;
+	c->slot->cy = c->cy;
+	c->slot->props.swap(job->props);	//the slot's old ones are cleared with the job
+	c->job = 0;
+	returnJob(job);
+	showChunk(c);
+}
 
-    //Index Buffer
-    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, o.indexBuffer);
-    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), &indices[0], GL_STATIC_DRAW);
+//Time of n chunk builds submitted to one worker, one after another, as the
+//game builds them, and the heap allocations made once the job, the worker
+//and the queues have seen one chunk. What is left is props storage growing
+//for a chunk with more of them than any before.
+void benchChunks(int n){
+	traceLog.startup = false;	//the startup table's totals would allocate
+	startWorkers(1);
+	ChunkJob* job = takeJob();
+	atomic<bool> built(false);
+	auto build = [job, &built](int i){
+		job->cx = i % 16 - 8;
+		job->cy = i / 16 - 8;
+		job->cancelled = false;
+		built = false;
+		submitChunk(job, 0, [&built]{ built = true; });
+		while (!built) this_thread::yield();
+	};
+	build(0);
+
+	long before = heapAllocations;
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < n; i++) build(i);
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	long allocations = heapAllocations - before;
+	stopWorkers();
+	returnJob(job);
+	printf("%d chunks of %dx%d: %.3f ms/chunk", n, ls, ls, ms / n);
+	if (heapCounted) printf(", %ld heap allocations\n", allocations);
+	else printf(", heap allocations not counted ('make counted')\n");
+}
 
-	//Texture Coordinates
-    glBindBuffer( GL_ARRAY_BUFFER, o.texCoordBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(texCoords), &texCoords[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_TexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(a_TexCoord);
+//Wall time of n chunk builds spread over 1, 2, 4 ... workers, up to one per
+//core, against a single worker. On one core there is nothing to compare
+//against, and it says so rather than printing a lone 1.00x.
+void benchWorkers(int n){
+	int cores = thread::hardware_concurrency();
+	if (cores < 1) cores = 1;
+	printf("%d core%s\n", cores, cores == 1 ? "" : "s");
+	vector<ChunkJob*> jobs(n);
+	double single = 0;
+	for (int threads = 1; ; threads = min(threads * 2, cores)){
+		startWorkers(threads);
+		workers.steals = 0;
+		atomic<int> left(n);
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < n; i++){
+			jobs[i] = takeJob();
+			jobs[i]->cx = i % 16 - 8;
+			jobs[i]->cy = i / 16 - 8;
+			jobs[i]->cancelled = false;
+			submitChunk(jobs[i], i, [&left]{ left--; });
+		}
+		while (left > 0) this_thread::sleep_for(chrono::microseconds(200));
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		stopWorkers();
+		for (int i = 0; i < n; i++) returnJob(jobs[i]);
+		if (threads == 1) single = ms;
+		printf("%2d workers: %d chunks in %.1f ms, %.2fx, %ld steals\n", threads, n, ms, single / ms, workers.steals.load());
+		if (threads == cores) break;
+	}
+	if (cores == 1) printf("One core: speedup across workers not measured\n");
+}
 
-    //Bind Texture
-    glEnable(GL_TEXTURE_2D);
-    glActiveTexture( GL_TEXTURE0);
-    glBindTexture(   GL_TEXTURE_2D, o.textureID);
-
-    if (file != "None"){
-	    int w, h;
-	    unsigned char* image = SOIL_load_image(file, &w, &h, 0, SOIL_LOAD_RGB);
-	    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w,h,
-	    	0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        SOIL_free_image_data(image);
-	}else{	
-		int c = 24;
-   		float pixels[c*c*3];
-   		for (int i = 0; i < c*c*3; i++){
-   			pixels[i] = 1.0f;
-   		}
-	    //Target active unit, level, internalformat, width, height, border, format, type, data
-	    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, c, c,
-	    	0, GL_RGB, GL_FLOAT, pixels);
-    }
+//False when the pool has no slot to give. Builds run nearest (lowest
+//priority) first.
+bool requestChunk(int cx, int cy, float priority){
+	ChunkSlot* cached = cachedSlot(cx, cy);
+	ChunkSlot* slot = cached ? cached : acquireSlot();
+	if (!slot) return false;
+	Chunk* c = new Chunk;
+	c->cx = cx;
+	c->cy = cy;
+	c->slot = slot;
+	chunks.push_back(c);
+	if (cached){
+		cached->active = true;
+		chunkPool.reused++;
+		showChunk(c);
+		return true;
+	}
 
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glGenerateMipmap(GL_TEXTURE_2D);
+	ChunkJob* job = takeJob();
+	job->cx = cx;
+	job->cy = cy;
+	job->cancelled = false;
+	job->root.copyFrom(scene.world(landNode));
+	c->job = job;
+
+	submitChunk(job, priority, [job]{
+		runOnMain([job]{ finishChunk(job); });
+	});
+	return true;
+}
 
-    //No Buffer Bound
-	glBindBuffer( GL_ARRAY_BUFFER, NULL);
-	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, NULL);
+void evictChunk(size_t k){
+	Chunk* c = chunks[k];
+	if (c->job) c->job->cancelled = true;
+	releaseSlot(c->slot);
+	if (c->resident){
+		scene.release(c->node);
+		propsDirty = true;
+	}
+	delete c;
+	chunks.erase(chunks.begin() + k);
 }
 
-void initCube(Primitives &o, const char* file) {
-	// Create a cube
-	//    v6----- v5
-	//   /|      /|
-	//  v1------v0|
-	//  | |     | |
-	//  | |v7---|-|v4
-	//  |/      |/
-	//  v2------v3
+//Player position in land grid units (inverse of landToWorld)
+void playerGrid(float &X, float &Y){
+	const float* m = scene.world(landNode).elements;
+	X = (user.px / m[0] + .05) / .1 + ls;
+	Y = (user.pz / m[10] + .05) / .1 + ls;
+}
 
-	const GLfloat vertices[] = {
-	    /*X,  Y,  Z  */
-		 .5, .5, .5,  -.5, .5, .5,  -.5,-.5, .5,   .5,-.5, .5,  
-		 .5, .5, .5,   .5,-.5, .5,   .5,-.5,-.5,   .5, .5,-.5,
-		 .5, .5, .5,   .5, .5,-.5,  -.5, .5,-.5,  -.5, .5, .5,
-		-.5, .5, .5,  -.5, .5,-.5,  -.5,-.5,-.5,  -.5,-.5, .5, 
-		-.5,-.5,-.5,   .5,-.5,-.5,   .5,-.5, .5,  -.5,-.5, .5, 
-		 .5,-.5,-.5,  -.5,-.5,-.5,  -.5, .5,-.5,   .5, .5,-.5 
-    };
+//Distance from (X, Y) to the square covered by chunk (cx, cy), grid units
+float chunkDistance(int cx, int cy, float X, float Y){
+	float dx = max(max(cx*ls - X, X - (cx+1)*ls), 0.0f);
+	float dy = max(max(cy*ls - Y, Y - (cy+1)*ls), 0.0f);
+	return sqrt(dx*dx + dy*dy);
+}
 
-    float n = 3;
-    const GLfloat texCoords[] = {
-		1.0, 1.0,   0.0, 1.0,   0.0, 0.0,   1.0, 0.0,    // v0-v1-v2-v3 front
-		0.0, 1.0,   0.0, 0.0,   1.0, 0.0,   1.0, 1.0,    // v0-v3-v4-v5 right
-		n,   0.0,   n,n,        0.0, n,     0.0, 0.0,    // v0-v5-v6-v1 up
-		1.0, 1.0,   0.0, 1.0,   0.0, 0.0,   1.0, 0.0,    // v1-v6-v7-v2 left
-		0.0, 0.0,   1.0, 0.0,   1.0, 1.0,   0.0, 1.0,    // v7-v4-v3-v2 down
-		0.0, 0.0,   1.0, 0.0,   1.0, 1.0,   0.0, 1.0     // v4-v7-v6-v5 back
-    };
+//Evict what is out of range, queue what came into range (nearest first)
+//and rebuild the prop batches when the resident set changed
+void updateChunks(){
+	float X, Y;
+	playerGrid(X, Y);
+	chunkPool.clock++;
+
+	for (int k = chunks.size() - 1; k >= 0; k--){
+		//Half a chunk of hysteresis so walking along an edge does not thrash
+		if (chunkDistance(chunks[k]->cx, chunks[k]->cy, X, Y) > viewDistance + ls/2){
+			evictChunk(k);
+		}
+	}
 
-    const GLfloat colors[] = {
-     /* R,   G,   B,  A, */
-	    0.1, 0.1, 1.0,1,  0.1, 0.1, 1.0,1,  0.1, 0.1, 1.0,1,  0.1, 0.1, 1.0,1,
-	    0.1, 1.0, 0.1,1,  0.1, 1.0, 0.1,1,  0.1, 1.0, 0.1,1,  0.1, 1.0, 0.1,1,
-	    1.0, 0.1, 0.1,1,  1.0, 0.1, 0.1,1,  1.0, 0.1, 0.1,1,  1.0, 0.1, 0.1,1,
-	    1.0, 1.0, 0.1,1,  1.0, 1.0, 0.1,1,  1.0, 1.0, 0.1,1,  1.0, 1.0, 0.1,1,
-	    1.0, 1.0, 1.0,1,  1.0, 1.0, 1.0,1,  1.0, 1.0, 1.0,1,  1.0, 1.0, 1.0,1,
-	    0.1, 1.0, 1.0,1,  0.1, 1.0, 1.0,1,  0.1, 1.0, 1.0,1,  0.1, 1.0, 1.0,1
-    };
+	int px = floor(X / ls), py = floor(Y / ls);
+	int reach = ceil(viewDistance / ls);
+	vector< pair<float, pair<int,int> > > wanted;
+	for (int cy = py - reach; cy <= py + reach; cy++){
+		for (int cx = px - reach; cx <= px + reach; cx++){
+			float d = chunkDistance(cx, cy, X, Y);
+			if (d <= viewDistance && !findChunk(cx, cy)){
+				wanted.push_back(make_pair(d, make_pair(cx, cy)));
+			}
+		}
+	}
+	sort(wanted.begin(), wanted.end());
 
-    const GLuint indices[] = {
-		 0, 1, 2,   0, 2, 3,    // front
-		 4, 5, 6,   4, 6, 7,    // right
-		 8, 9,10,   8,10,11,    // up
-		12,13,14,  12,14,15,    // left
-		16,17,18,  16,18,19,    // down
-		20,21,22,  20,22,23     // back    	
-    };
-  
-    o.numIndices = sizeof(indices) / 4;
+	for (size_t k = 0; k < wanted.size() && (int)chunks.size() < maxChunks; k++){
+		if (!requestChunk(wanted[k].second.first, wanted[k].second.second, wanted[k].first)) break;
+	}
 
-    // Create buffer objects
-	glGenBuffers( 1, &o.vertexBuffer );
-	glGenBuffers( 1, &o.colorBuffer );
-	glGenBuffers( 1, &o.indexBuffer );
-	glGenBuffers( 1, &o.texCoordBuffer );
-	glGenTextures( 1, &o.textureID );
+	if (propsDirty){
+		vector<const vector<PropInstance>*> lists;
+		for (size_t k = 0; k < chunks.size(); k++){
+			if (chunks[k]->resident) lists.push_back(&chunks[k]->slot->props);
+		}
+		Trace t("props rebuild");
+		rebuildProps(lists);
+		propsDirty = false;
+	}
+}
 
-    //Position
-    glBindBuffer( GL_ARRAY_BUFFER, o.vertexBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(vertices), &vertices[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_Position, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(a_Position);
 
-    //Color
-    glBindBuffer( GL_ARRAY_BUFFER, o.colorBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(colors), &colors[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_Color, 4, GL_FLOAT, GL_FALSE, 0, 0 );
-    glEnableVertexAttribArray(a_Color);
+/////////////////////HUD
+//Performance overlay, 'h' toggles it. Text and the frame time graph are
+//quads in one vertex buffer drawn with a single call; glyphs come from a
+//5x7 font in a small texture on unit 1, and plain quads sample its solid
+//cell.
+
+//Columns of ' ' to '_', bit 0 at the top; lower case is drawn upper case
+const unsigned char hudFont[64][5] = {
+	{0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5F,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7F,0x14,0x7F,0x14},
+	{0x24,0x2A,0x7F,0x2A,0x12}, {0x23,0x13,0x08,0x64,0x62}, {0x36,0x49,0x55,0x22,0x50}, {0x00,0x05,0x03,0x00,0x00},
+	{0x00,0x1C,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1C,0x00}, {0x08,0x2A,0x1C,0x2A,0x08}, {0x08,0x08,0x3E,0x08,0x08},
+	{0x00,0x50,0x30,0x00,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x60,0x60,0x00,0x00}, {0x20,0x10,0x08,0x04,0x02},
+	{0x3E,0x51,0x49,0x45,0x3E}, {0x00,0x42,0x7F,0x40,0x00}, {0x42,0x61,0x51,0x49,0x46}, {0x21,0x41,0x45,0x4B,0x31},
+	{0x18,0x14,0x12,0x7F,0x10}, {0x27,0x45,0x45,0x45,0x39}, {0x3C,0x4A,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03},
+	{0x36,0x49,0x49,0x49,0x36}, {0x06,0x49,0x49,0x29,0x1E}, {0x00,0x36,0x36,0x00,0x00}, {0x00,0x56,0x36,0x00,0x00},
+	{0x08,0x14,0x22,0x41,0x00}, {0x14,0x14,0x14,0x14,0x14}, {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x51,0x09,0x06},
+	{0x32,0x49,0x79,0x41,0x3E}, {0x7E,0x11,0x11,0x11,0x7E}, {0x7F,0x49,0x49,0x49,0x36}, {0x3E,0x41,0x41,0x41,0x22},
+	{0x7F,0x41,0x41,0x22,0x1C}, {0x7F,0x49,0x49,0x49,0x41}, {0x7F,0x09,0x09,0x01,0x01}, {0x3E,0x41,0x41,0x51,0x32},
+	{0x7F,0x08,0x08,0x08,0x7F}, {0x00,0x41,0x7F,0x41,0x00}, {0x20,0x40,0x41,0x3F,0x01}, {0x7F,0x08,0x14,0x22,0x41},
+	{0x7F,0x40,0x40,0x40,0x40}, {0x7F,0x02,0x04,0x02,0x7F}, {0x7F,0x04,0x08,0x10,0x7F}, {0x3E,0x41,0x41,0x41,0x3E},
+	{0x7F,0x09,0x09,0x09,0x06}, {0x3E,0x41,0x51,0x21,0x5E}, {0x7F,0x09,0x19,0x29,0x46}, {0x46,0x49,0x49,0x49,0x31},
+	{0x01,0x01,0x7F,0x01,0x01}, {0x3F,0x40,0x40,0x40,0x3F}, {0x1F,0x20,0x40,0x20,0x1F}, {0x7F,0x20,0x18,0x20,0x7F},
+	{0x63,0x14,0x08,0x14,0x63}, {0x03,0x04,0x78,0x04,0x03}, {0x61,0x51,0x49,0x45,0x43}, {0x00,0x7F,0x41,0x41,0x00},
+	{0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x7F,0x00}, {0x04,0x02,0x01,0x02,0x04}, {0x40,0x40,0x40,0x40,0x40},
+};
+const int hudCell = 6;	//5 columns and a gap
+const int hudGlyphs = 65;	//the font, then one solid cell
+const int hudScale = 2;
+const int hudHistory = 120;	//frames in the graph
 
-    //Texture Coordinates
-    glBindBuffer( GL_ARRAY_BUFFER, o.texCoordBuffer);
-    glBufferData( GL_ARRAY_BUFFER, sizeof(texCoords), &texCoords[0], GL_STATIC_DRAW);
-    glVertexAttribPointer(a_TexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(a_TexCoord);
+static const char* hud_vertex_source =
+    "   #version 130 \n"
+    "   uniform vec2 u_Screen; \n"
+    "   in vec2 a_Position; \n"
+    "   in vec2 a_TexCoord; \n"
+    "   in vec4 a_Color; \n"
+    "   out vec4 v_Color; \n"
+    "   out vec2 v_TexCoord; \n"
+    "   void main() { \n"
+    "       gl_Position = vec4(a_Position.x / u_Screen.x * 2.0 - 1.0, 1.0 - a_Position.y / u_Screen.y * 2.0, 0.0, 1.0); \n"
+    "       v_Color = a_Color; \n"
+    "       v_TexCoord = a_TexCoord; \n"
+    "   } \n";
 
-    //Bind Texture
-    glActiveTexture( GL_TEXTURE0);
-    glBindTexture(   GL_TEXTURE_2D, o.textureID);
-
-    if (file != "None"){
-	    int w, h;
-	    unsigned char* image = SOIL_load_image(file, &w, &h, 0, SOIL_LOAD_RGB);
-	    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w,h,
-	    	0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	    SOIL_free_image_data(image);
-	}else{
-	    float pixels[] = {
-	    	1.0f, 1.0f, 1.0f,   0.0f, 0.0f, 0.0f,
-	    	0.0f, 0.0f, 0.0f,   1.0f, 1.0f, 1.0f,
-	    };
-	    //Target active unit, level, internalformat, width, height, border, format, type, data
-	    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 2, 2,
-	    	0, GL_RGB, GL_FLOAT, pixels);
-    }
+static const char* hud_fragment_source =
+    "   #version 130 \n"
+    "   uniform sampler2D u_Font; \n"
+    "   in vec4 v_Color; \n"
+    "   in vec2 v_TexCoord; \n"
+    "   void main() { \n"
+    "       gl_FragColor = vec4(v_Color.rgb, v_Color.a * texture(u_Font, v_TexCoord).r); \n"
+    "   } \n";
 
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glGenerateMipmap(GL_TEXTURE_2D);
+struct HudVertex {
+	float x, y, u, v;
+	float color[4];
+};
 
-    //Index Buffer
-    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, o.indexBuffer);
-    glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), &indices[0], GL_STATIC_DRAW);
+struct Hud {
+	int shown = 0;
+	GLuint program = 0, buffer = 0, font = 0;
+	GLint screen = -1, sampler = -1;
+	vector<HudVertex> vertices;
+	float frameMs[hudHistory];	//start to start
+	int next = 0;
+	double lastStart = 0;
+	double cpuMs = 0, ms = 0;	//the last frame, the HUD itself
+} hud;
+
+void initHud(){
+	hud.program = createProgram( hud_vertex_source, hud_fragment_source );
+	hud.screen = glGetUniformLocation( hud.program, "u_Screen" );
+	hud.sampler = glGetUniformLocation( hud.program, "u_Font" );
+	genBuffers( MEM_OVERLAY, 1, &hud.buffer );
+	labelBuffer(hud.buffer, "hud vertices");
+	labelObject(GL_PROGRAM, hud.program, "hud");
+	memset(hud.frameMs, 0, sizeof(hud.frameMs));
+
+	int width = hudGlyphs * hudCell;
+	vector<unsigned char> texels(width * 8, 0);
+	for (int g = 0; g < hudGlyphs; g++){
+		for (int c = 0; c < hudCell; c++){
+			for (int r = 0; r < 8; r++){
+				bool on = g == hudGlyphs - 1 || (c < 5 && r < 7 && (hudFont[g][c] >> r & 1));
+				texels[r * width + g * hudCell + c] = on ? 255 : 0;
+			}
+		}
+	}
+	genTextures( MEM_OVERLAY, 1, &hud.font );
+	glActiveTexture( GL_TEXTURE1 );
+	glBindTexture( GL_TEXTURE_2D, hud.font );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	texImage2D( hud.font, GL_TEXTURE_2D, 0, GL_R8, width, 8, GL_RED, GL_UNSIGNED_BYTE, &texels[0] );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
+	glActiveTexture( GL_TEXTURE0 );
+	labelObject(GL_TEXTURE, hud.font, "hud font");
+}
 
-    //No Buffer Bound
-	glBindBuffer( GL_ARRAY_BUFFER, NULL);
-	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, NULL);
+void toggleHud(){
+	hud.shown = !hud.shown;
+}
 
+void hudQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, const float* color){
+	//Color is filled in per vertex below
+	HudVertex q[4] = {
+		{ x0, y0, u0, v0, {} }, { x1, y0, u1, v0, {} }, { x1, y1, u1, v1, {} }, { x0, y1, u0, v1, {} },
+	};
+	const int order[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int k = 0; k < 6; k++){
+		HudVertex v = q[order[k]];
+		memcpy(v.color, color, sizeof(v.color));
+		hud.vertices.push_back(v);
+	}
 }
 
+void hudRect(float x0, float y0, float x1, float y1, const float* color){
+	float u = (hudGlyphs - .5f) / hudGlyphs;
+	hudQuad(x0, y0, x1, y1, u, .5f, u, .5f, color);
+}
 
+void hudText(float x, float y, const char* s, const float* color){
+	for (; *s; s++, x += hudCell * hudScale){
+		int c = toupper(*s) - ' ';
+		if (c <= 0 || c >= 64) continue;
+		float u0 = c / (float)hudGlyphs, u1 = (c + 1) / (float)hudGlyphs;
+		hudQuad(x, y, x + hudCell * hudScale, y + 8 * hudScale, u0, 0, u1, 1, color);
+	}
+}
 
+//End of a frame's drawing, before the swap. frameStart is the frame's
+//trace time.
+void drawHud(double frameStart){
+	double start = traceNow();
+	if (hud.lastStart > 0) hud.frameMs[hud.next] = (frameStart - hud.lastStart) / 1000;
+	hud.next = (hud.next + 1) % hudHistory;
+	hud.lastStart = frameStart;
+	hud.cpuMs = (start - frameStart) / 1000;
+	if (!hud.shown || !hud.program) return;
+	Trace t("hud");
+	DebugGroup g("hud");
+
+	double sum = 0;
+	for (int k = 1; k <= 30; k++) sum += hud.frameMs[(hud.next - k + hudHistory) % hudHistory];
+	int resident = 0;
+	for (size_t k = 0; k < chunks.size(); k++) resident += chunks[k]->resident;
+
+	const float panel[4] = { 0, 0, 0, .6f };
+	const float text[4] = { 1, 1, 1, 1 };
+	const float good[4] = { .3f, .9f, .4f, 1 };
+	const float slow[4] = { 1, .8f, .2f, 1 };
+	const float bad[4] = { 1, .3f, .3f, 1 };
+	const float rule[4] = { 1, 1, 1, .35f };
+	float lineHeight = 10 * hudScale;
+	float x = 20, y = 20;
+	const double MB = 1048576.0;
+	const int lines = 8;
+	char line[lines][96];
+	snprintf(line[0], 96, "FPS %.1f  CPU %.2f MS  GPU %.2f MS", sum > 0 ? 30000 / sum : 0.0, hud.cpuMs, gpuTimer.frameMs);
+	snprintf(line[1], 96, "DRAWS %d  TRIS %.2fM", frameStats.draws, frameStats.triangles / 1e6);
+	snprintf(line[2], 96, "CHUNKS %d RESIDENT %d DRAWN  SLOTS %d", resident, frameStats.chunksDrawn, (int)chunkPool.slots.size());
+	if (gpuBudget() > 0) snprintf(line[3], 96, "GPU %.1f OF %.0f MB  PEAK %.1f", gpuMemory.total / MB, gpuMemory.budgetMB, gpuMemory.peakTotal / MB);
+	else snprintf(line[3], 96, "GPU %.1f MB  PEAK %.1f", gpuMemory.total / MB, gpuMemory.peakTotal / MB);
+	snprintf(line[4], 96, "TERRAIN %.1f  PROPS %.1f  TEXTURES %.1f", gpuMemory.bytes[MEM_TERRAIN] / MB,
+		gpuMemory.bytes[MEM_PROPS] / MB, gpuMemory.bytes[MEM_TEXTURES] / MB);
+	snprintf(line[5], 96, "STAGING %.1f  OVERLAY %.1f", gpuMemory.bytes[MEM_STAGING] / MB, gpuMemory.bytes[MEM_OVERLAY] / MB);
+	snprintf(line[6], 96, "QUEUE %d PEAK %d  DEFERRED %d  STALLS %ld %.1f MS", mainQueue.depth(), mainQueue.peak.load(),
+		mainQueue.deferred, mainQueue.stalls.load(), mainQueue.stallUs / 1000.0);
+	snprintf(line[7], 96, "HUD %.3f MS", hud.ms);
+
+	hud.vertices.clear();
+	float graphHeight = 100, barWidth = 3;
+	float width = hudHistory * barWidth;
+	for (int k = 0; k < lines; k++) width = max(width, (float)strlen(line[k]) * hudCell * hudScale);
+	hudRect(x - 10, y - 10, x + width + 10, y + lines * lineHeight + graphHeight + 20, panel);
+	for (int k = 0; k < lines; k++) hudText(x, y + k * lineHeight, line[k], text);
+
+	//Bars scaled so the top is 33 ms (30 fps), with a rule at 60 fps
+	float base = y + lines * lineHeight + graphHeight + 5;
+	for (int k = 0; k < hudHistory; k++){
+		float ms = hud.frameMs[(hud.next + k) % hudHistory];
+		float h = min(ms / 33.3f, 1.0f) * graphHeight;
+		hudRect(x + k * barWidth, base - h, x + (k + 1) * barWidth - 1, base, ms > 33.4f ? bad : ms > 17.5f ? slow : good);
+	}
+	float sixty = base - 16.7f / 33.3f * graphHeight;
+	hudRect(x, sixty, x + hudHistory * barWidth, sixty + 1, rule);
+
+	glUseProgram( hud.program );
+	glUniform2f( hud.screen, WIDTH, HEIGHT );
+	glUniform1i( hud.sampler, 1 );
+	glActiveTexture( GL_TEXTURE1 );
+	glBindTexture( GL_TEXTURE_2D, hud.font );
+	glActiveTexture( GL_TEXTURE0 );
+
+	glBindBuffer( GL_ARRAY_BUFFER, hud.buffer );
+	bufferData( hud.buffer, GL_ARRAY_BUFFER, hud.vertices.size() * sizeof(HudVertex), &hud.vertices[0], GL_STREAM_DRAW );
+	glVertexAttribPointer( a_Position, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)0 );
+	glVertexAttribPointer( a_TexCoord, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)(2 * sizeof(float)) );
+	glVertexAttribPointer( a_Color, 4, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)(4 * sizeof(float)) );
+	glEnableVertexAttribArray( a_Position );
+	glEnableVertexAttribArray( a_TexCoord );
+	glEnableVertexAttribArray( a_Color );
+	glDisableVertexAttribArray( a_Ridge );
+
+	glDisable( GL_DEPTH_TEST );
+	glEnable( GL_BLEND );
+	glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+	glDrawArrays( GL_TRIANGLES, 0, hud.vertices.size() );
+	glDisable( GL_BLEND );
+	glEnable( GL_DEPTH_TEST );
 
-Matrix4 viewMatrix;
-Matrix4 projMatrix;
-Matrix4 modelMatrix;
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	glUseProgram( program );
+	hud.ms = (traceNow() - start) / 1000;
+}
 
-void render(Primitives &o){
+/////////////////////Options
+//Everything the prompt and the compile-time constants used to decide. Each
+//flag "--name value" can also be a line "name value" in a --config file;
+//the command line wins over the file.
+
+struct Options {
+	int seed = -1;	//-1: from the clock
+	string preset;	//empty: ask on stdin
+	string config;
+	int vsync = -1;	//-1: driver default; 0 also uncaps the frame timer
+	int frames = 0;	//exit after this many frames, 0: run until 'z'
+	int benchTransforms = 0;
+	int benchChunks = 0;
+	int benchWorkers = 0;
+	string effects;	//shader effects for the land, e.g. "stripes,turb"
+} options;
+
+enum { OPT_INT, OPT_FLOAT, OPT_STRING };
+
+struct OptionSpec {
+	const char* name;
+	int type;
+	void* value;
+	const char* help;
+};
 
-	//Activate Vertex Coordinates
-    glBindBuffer( GL_ARRAY_BUFFER, o.vertexBuffer);
-    glVertexAttribPointer(a_Position, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(a_Position);
+OptionSpec optionSpecs[] = {
+	{ "seed", OPT_INT, &options.seed, "land seed (default: random)" },
+	{ "preset", OPT_STRING, &options.preset, "preset number or name (default: prompt)" },
+	{ "presets", OPT_STRING, &presetsFile, "presets file" },
+	{ "config", OPT_STRING, &options.config, "file of 'name value' lines" },
+	{ "width", OPT_INT, &WIDTH, "window width" },
+	{ "height", OPT_INT, &HEIGHT, "window height" },
+	{ "chunk-size", OPT_INT, &ls, "quads per chunk side" },
+	{ "view-distance", OPT_FLOAT, &viewDistance, "grid units to load land around the player (default: chunk size)" },
+	{ "chunks", OPT_INT, &maxChunks, "most chunks resident at once" },
+	{ "chunk-pool", OPT_FLOAT, &chunkPool.budgetMB, "MB of chunk buffers kept, including chunks out of view (default 128)" },
+	{ "vsync", OPT_INT, &options.vsync, "1 on, 0 off and uncapped" },
+	{ "frames", OPT_INT, &options.frames, "exit after N frames and print timing" },
+	{ "bench-transforms", OPT_INT, &options.benchTransforms, "time N transform updates and exit" },
+	{ "bench-chunks", OPT_INT, &options.benchChunks, "time N chunk builds on one worker and exit; 'make counted' also counts their heap allocations" },
+	{ "bench-workers", OPT_INT, &options.benchWorkers, "time N chunk builds on 1, 2, 4 ... workers and exit" },
+	{ "effects", OPT_STRING, &options.effects, "land shader effects: stripes,turb (default: none; 'e' cycles)" },
+	{ "shaders", OPT_STRING, &shaderDir, "directory of land.vert, land.frag and props.vert" },
+	{ "upload-budget", OPT_FLOAT, &uploadBudgetMs, "ms per frame for finished background work on the GL thread (default 4, 0: no limit)" },
+	{ "gpu-budget", OPT_FLOAT, &gpuMemory.budgetMB, "MB of buffers and textures to stay under (default: no limit)" },
+	{ "hud", OPT_INT, &hud.shown, "1 starts with the performance overlay shown ('h' toggles)" },
+	{ "trace", OPT_STRING, &traceFile, "write a Chrome trace of startup, chunk builds and frames here at exit" },
+};
+const int optionCount = sizeof(optionSpecs) / sizeof(optionSpecs[0]);
 
-  	//Activate Color Coordinates
-	glBindBuffer( GL_ARRAY_BUFFER, o.colorBuffer);
-	glVertexAttribPointer(a_Color, 4, GL_FLOAT, GL_FALSE, 0, 0);
-	glEnableVertexAttribArray(a_Color);
+void printUsage(const char* program){
+	printf("usage: %s [--name value]...\n", program);
+	for (int k = 0; k < optionCount; k++){
+		printf("  --%-18s %s\n", optionSpecs[k].name, optionSpecs[k].help);
+	}
+}
 
-	//Activate Texture Coordinates
-	glBindBuffer( GL_ARRAY_BUFFER, o.texCoordBuffer);
-	glVertexAttribPointer(a_TexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	glEnableVertexAttribArray(a_TexCoord);
+bool setOption(const char* name, const char* value){
+	for (int k = 0; k < optionCount; k++){
+		const OptionSpec &o = optionSpecs[k];
+		if (strcmp(o.name, name) != 0) continue;
+		char* end = 0;
+		if (o.type == OPT_INT) *(int*)o.value = strtol(value, &end, 10);
+		else if (o.type == OPT_FLOAT) *(float*)o.value = strtof(value, &end);
+		else *(string*)o.value = value;
+		if (end && (end == value || *end)){
+			fprintf(stderr, "--%s: expected a number, got '%s'\n", name, value);
+			return false;
+		}
+		return true;
+	}
+	fprintf(stderr, "Unknown option %s\n", name);
+	return false;
+}
+
+bool loadConfig(const string &file){
+	FILE* f = fopen(file.c_str(), "r");
+	if (!f){
+		fprintf(stderr, "Could not open %s\n", file.c_str());
+		return false;
+	}
+	char line[512];
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), f)){
+		char* hash = strchr(line, '#');
+		if (hash) *hash = 0;
+		char* name = strtok(line, " \t\r\n");
+		if (!name) continue;
+		char* value = strtok(0, "\r\n");
+		if (value) value += strspn(value, " \t");
+		if (strcmp(name, "config") == 0){
+			fprintf(stderr, "%s: config files cannot load other config files\n", file.c_str());
+			ok = false;
+			break;
+		}
+		ok = value && *value ? setOption(name, value) : setOption(name, "");
+	}
+	fclose(f);
+	return ok;
+}
 
-	//Bind Texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture( GL_TEXTURE_2D, o.textureID);
+//Flags starting with "--" are ours; GLUT's own (-display, -geometry, ...)
+//are left for glutInit. Returns false when the program should exit.
+bool parseOptions(int argc, char** argv, bool &failed){
+	failed = false;
+	for (int n = 1; n < argc; n++){
+		if (strcmp(argv[n], "--help") == 0){
+			printUsage(argv[0]);
+			return false;
+		}
+		if (strcmp(argv[n], "--config") == 0 && n + 1 < argc){
+			options.config = argv[n+1];
+			if (!loadConfig(options.config)){ failed = true; return false; }
+		}
+	}
+	for (int n = 1; n < argc; n++){
+		if (strncmp(argv[n], "--", 2) != 0) continue;
+		if (n + 1 >= argc){
+			fprintf(stderr, "%s needs a value\n", argv[n]);
+			failed = true;
+			return false;
+		}
+		if (!setOption(argv[n] + 2, argv[n+1])){ failed = true; return false; }
+		n++;
+	}
+	if (!parseShaderFeatures(options.effects, terrainFeatures)){
+		failed = true;
+		return false;
+	}
+	if (WIDTH < 1 || HEIGHT < 1 || ls < 16 || maxChunks < 1){
+		fprintf(stderr, "width, height and chunks must be positive, chunk-size at least 16\n");
+		failed = true;
+		return false;
+	}
+	return true;
+}
 
-	//Bind Indices
-	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, o.indexBuffer);
+//glXSwapIntervalEXT where available, else the MESA/SGI variants
+void setSwapInterval(int interval){
+	typedef void (*SwapIntervalEXT)(Display*, GLXDrawable, int);
+	typedef int (*SwapInterval)(int);
+	SwapIntervalEXT ext = (SwapIntervalEXT)glXGetProcAddress((const GLubyte*)"glXSwapIntervalEXT");
+	if (ext){
+		ext(glXGetCurrentDisplay(), glXGetCurrentDrawable(), interval);
+		return;
+	}
+	SwapInterval other = (SwapInterval)glXGetProcAddress((const GLubyte*)"glXSwapIntervalMESA");
+	if (!other && interval > 0) other = (SwapInterval)glXGetProcAddress((const GLubyte*)"glXSwapIntervalSGI");
+	if (other) other(interval);
+}
 
-	//Update uniforms in frag vertex  //1 denotes number of matrixes to update
-    glUniformMatrix4fv( u.ViewMatrix, 1, GL_TRUE, viewMatrix.elements);
-    glUniformMatrix4fv( u.ProjMatrix, 1, GL_TRUE, projMatrix.elements);
-    glUniformMatrix4fv( u.ModelMatrix, 1, GL_TRUE, modelMatrix.elements);
-    glUniform1i( u.Sampler, 0);
+int frameCount = 0;
+chrono::steady_clock::time_point firstFrame;
+double firstFrameShown = 0;	//trace time, microseconds
 
-    //DrawElements allows to display Cube, etc, with fewer indices
-    glDrawElements( GL_TRIANGLES, o.numIndices, GL_UNSIGNED_INT, 0);
-   
+//Milliseconds between frames for glutTimerFunc
+float frameInterval(){
+	return options.vsync == 0 ? 0 : 1000.0/60.0;
 }
 
+//--frames: count this frame and exit with timing once the budget is spent
+void countFrame(){
+	if (frameCount++ == 0) firstFrame = chrono::steady_clock::now();
+	if (options.frames <= 0 || frameCount < options.frames) return;
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - firstFrame).count();
+	printf("%d frames in %.2f s, %.2f ms/frame, %d chunks resident\n", frameCount, seconds,
+		frameCount > 1 ? seconds * 1000 / (frameCount - 1) : 0.0, (int)chunks.size());
+	printf("GL queue: peak %d of %u, %d frames deferred work, workers stalled %ld times for %.1f ms\n",
+		mainQueue.peak.load(), MainQueue::size, mainQueue.deferred, mainQueue.stalls.load(), mainQueue.stallUs / 1000.0);
+	printGpuMemory();
+	exit(0);
+}
+
+//Every chunk in view is built and uploaded, and every texture decoded
+bool landReady(){
+	if (frameCount == 0 || chunks.empty() || texturesPending > 0) return false;
+	for (size_t k = 0; k < chunks.size(); k++){
+		if (!chunks[k]->resident) return false;
+	}
+	return true;
+}
 
 void display(int te){
+    Trace frame("frame");
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glutTimerFunc(1000.0/60.0, display, 1);
+    glutTimerFunc(frameInterval(), display, 1);
+    countFrame();
+    beginGpuFrame();
+    frameStats = FrameStats();
+    Trace tasks("main tasks");
+    DebugGroup uploads("main tasks");
+    runMainTasks(); //Finished chunk builds and texture loads, within budget
+    pollWatches(); //Edited presets or shaders
+    pollShaders();
+    uploads.pop();
+    tasks.stop();
+    Trace navigate("navigate");
     smoothNavigate(); //Update user movement
+    navigate.stop();
+    updateChunks();
 
+    //Every texture is a layer of the one array: the only bind this frame
+    glActiveTexture( GL_TEXTURE0);
+    glBindTexture( GL_TEXTURE_2D_ARRAY, layers.id);
+
+    Trace matrices("matrices");
     u.Tx += 1;
     glUniform4f(u.Translation, u.Tx, u.Ty, u.Tz, 0.0);
 
@@ -1151,50 +4706,110 @@ void display(int te){
 	//Update Time
 	glUniform1f( u.Time, u.Tx );
 
+	updatePalette();
+	uploadPalette(u);
+
 	//Cube
-	modelMatrix.setTranslate(-3,user.py,-1);
-	modelMatrix.rotate(u.Tx, 1*sin(u.Tx*.01),1,0);
-	//render(oneCube);
+	scene.edit(cubeNode).setTranslate(-3,user.py,-1);
+	scene.edit(cubeNode).rotate(u.Tx, 1*sin(u.Tx*.01),1,0);
     
     //Plane
-	modelMatrix.setTranslate(1,user.py,-1);
-	modelMatrix.scale(3,3,3);
-	//render(onePlane);
-
-	//Land
-	int rrr = SEED % 2;
-	if (rrr == 0) rrr = 2;
-	int s = 48;
+	scene.edit(planeNode).setTranslate(1,user.py,-1);
+	scene.edit(planeNode).scale(3,3,3);
 
-	modelMatrix.setScale(s,rrr,s);
-	modelMatrix.translate(0,-8,0);
-	render(oneLand);
+	scene.update();
+	matrices.stop();
 
-	modelMatrix.setScale(s,rrr,s);
-	modelMatrix.translate(0,-8,-216*.1);
-	render(twoLand);
+	//modelMatrix.copyFrom(scene.world(cubeNode));
+	//render(oneCube);
+	//modelMatrix.copyFrom(scene.world(planeNode));
+	//render(onePlane);
 
-	modelMatrix.setScale(s,rrr,s);
-	modelMatrix.translate(-216*.1,-8,-216*.1);
-	render(threeLand);
+	//Land
+	{
+		Trace t("land");
+		GpuTrace g("land (gpu)");
+		DebugGroup group("land");
+		for (size_t k = 0; k < chunks.size(); k++){
+			if (!chunks[k]->resident) continue;
+			modelMatrix.copyFrom(scene.world(chunks[k]->node));
+			render(chunks[k]->slot->land);
+			frameStats.chunksDrawn++;
+		}
+	}
 
-	modelMatrix.setScale(s,rrr,s);
-	modelMatrix.translate(-216*.1,-8,0);
-	render(fourLand);
+	renderAllProps();
+	drawHud(frame.start);
    
+    Trace swap("swap");
     glutSwapBuffers();
+    swap.stop();
+    frame.stop();
+    if (captureRequested){
+    	captureRequested = 0;
+    	captureFrames();
+    }
+    if (firstFrameShown == 0) firstFrameShown = traceNow();
+    if (traceLog.startup && landReady()) printStartup(firstFrameShown);
 }
 
 int main(int argc, char** argv)
 {
+	bool failed;
+	if (!parseOptions(argc, argv, failed)){
+		return failed ? 1 : 0;
+	}
+	if (options.benchTransforms > 0){
+		benchTransforms(options.benchTransforms);
+		return 0;
+	}
+	if (options.benchChunks > 0){
+		if (options.seed >= 0) SEED = options.seed;
+		benchChunks(options.benchChunks);
+		return 0;
+	}
+	if (options.benchWorkers > 0){
+		if (options.seed >= 0) SEED = options.seed;
+		benchWorkers(options.benchWorkers);
+		return 0;
+	}
+	if (viewDistance <= 0) viewDistance = ls;
+	nameTraceThread("main");
+	glThread = true;
+	if (!traceFile.empty()) atexit(writeTrace);
+#ifdef SIGUSR1
+	signal(SIGUSR1, requestCapture);
+#endif
+
+	Trace files("read files");
+	if (!loadPresets(presetsFile, presets)){
+		return 1;
+	}
+	if (!terrainShaders.load() || !instanceShaders.load()){
+		return 1;
+	}
+	files.stop();
 
-	printf("Input World Color Type, 0-13. 0 is Random: \n");
-    int world_color;
-    scanf("%i", &world_color);
+	const char* presetArg = options.preset.empty() ? 0 : options.preset.c_str();
+	int world_color = presetArg ? findPreset(presetArg) : -1;
+	if (presetArg && world_color < 0){
+		fprintf(stderr, "Unknown preset %s\n", presetArg);
+		return 1;
+	}
+	if (!presetArg){
+		printf("Input World Color Type, 0-%d. 0 is Random: \n", (int)presets.size() - 1);
+		scanf("%i", &world_color);
+	}
 
-	srand(time(0));
-	SEED = rand() % 999;
+	if (options.seed >= 0){
+		srand(options.seed);
+		SEED = options.seed;
+	}else{
+		srand(time(0));
+		SEED = rand() % 999;
+	}
 
+    Trace window("window");
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
     glutInitContextVersion (3, 2);
@@ -1206,8 +4821,11 @@ int main(int argc, char** argv)
     glutSpecialFunc(SpecialKeyHandler);
     glutSpecialUpFunc(SpecialKeyUpHandler);
     glutKeyboardFunc(NormalKeyHandler);
+    if (options.vsync >= 0) setSwapInterval(options.vsync);
+    window.stop();
 
     // Initialize GLEW
+    Trace glew("glew");
     glewExperimental = GL_TRUE; 
     if (glewInit() != GLEW_OK) {
         fprintf(stderr, "Failed to initialize GLEW\n");
@@ -1219,133 +4837,33 @@ int main(int argc, char** argv)
         //cerr << "GlEW Available";
     }else
         return 0;
+    glew.stop();
 
-    GLuint vs, fs, program;
-    vs = initShader( GL_VERTEX_SHADER, vertex_source );
-    fs = initShader( GL_FRAGMENT_SHADER, fragment_source );
-    if (vs == -1 || fs == -1){ return 0; }
+    initDebugOutput();
 
-    //Create and use shader program
-    program = glCreateProgram();
-    glAttachShader( program, vs );
-    glAttachShader( program, fs );
+    //Let the driver build programs on as many threads as it likes
+    if (GLEW_KHR_parallel_shader_compile) glMaxShaderCompilerThreadsKHR( 0xFFFFFFFF );
 
-    //Must link after BindAttrib
-    glLinkProgram( program );
-    glUseProgram( program );
+    //Create and use shader program
+    //Land in the variant asked for, props always plain
+    Trace shaders("shaders");
+    instanceProgram = instanceShaders.get(0);
+    if (instanceProgram == 0 || !useTerrainFeatures(terrainFeatures)){ return 0; }
+    shaders.stop();
 
 	glEnable( GL_DEPTH_TEST );
     glDepthFunc( GL_LESS );
 
-    makeRand = rand() % 13; makeRand = world_color;
-
-	if (makeRand == 0){
-		printf("TOTAL RANDOM\n");
-		world.red = rand() % 255; world.red/=155;
-		world.gre = rand() % 255; world.gre/=155;
-		world.blu = rand() % 255; world.blu/=155;
-		world.q = rand()%100; world.q/=100; world.q+=.5;
-    	world.w = rand()%100; world.w/=100; world.w+=.5;
-		world.j = rand()%100; world.j/=100; world.j+=.5;
-	}
-
-	//PINK PURPLE
-	if (makeRand == 1){ 
-		printf("PINK PURPLE\n");
-		world.red = 1.28387; world.gre = 0.735484; world.blu = 1.09677; 
-		world.q = 1.26; world.w = 1.5; world.j = .52;
-	}
-	//DEEP RED
-	if (makeRand == 2){ 
-		printf("DEEP RED\n");
-		world.red = 1.47742; world.gre = 0.083871; world.blu = 0.16129; 
-		world.q = 1.44;  world.w = 0.79;  world.j = 1.41;
-	}
-	//ARCTIC
-	if (makeRand == 3){ 
-		printf("ARCTIC\n");
-		world.red = 0.787097; world.gre = 1.23226; world.blu = 1.6;
-		world.q = 0.84;  world.w = 1.13;  world.j = 1.31;
-	}
-	//DARK SEPIA
-	if (makeRand == 4){ 
-		printf("DARK SEPIA\n");
-		world.red = 1.07097; world.gre = 0.819355; world.blu = 0.632258; 
-		world.q = 1.26;  world.w = 0.76;  world.j = 1.19; 
-	}
-	//DEEP BLUE
-	if (makeRand == 5){ 
-		printf("DEEP BLUE\n");
-		world.red = 0.135484; world.gre = 0.206452; world.blu = 1.43226; 
-		world.q = 1.27;  world.w = 0.79;  world.j = 1.54;
-	}
-	//GREEN MATRIX
-	if (makeRand == 6){ 
-		printf("GREEN MATRIX\n");
-		world.red = 0.219355; world.gre = 1.14194; world.blu = 0.548387; 
-		world.q = 0.66; world.w = 0.92; world.j = 0.77;
-	}
-	//COLD
-	if (makeRand == 7){
-		printf("COLD\n");
-		world.red = 0.812903; world.gre = 0.703226; world.blu = 1.40645;
-		world.q = 1.34; world.w = 1.31; world.j = 1.38;
-	}
-	//VELVET
-	if (makeRand == 8){ 
-		printf("VELVET\n");
-		world.red = 216/255.0; world.gre = 255/255.0; world.blu = 171/255.0;
-		world.q = .7; world.w = 2.3; world.j = 1.3;
-	}
-	//EXTREME
-	if (makeRand == 9){
-		printf("EXTREME");
-		world.red = rand() % 255; world.red/=155;
-		world.gre = rand() % 255; world.gre/=155;
-		world.blu = rand() % 255; world.blu/=155;
-		world.q = rand()%100*10; world.q/=100; world.q+=.5;
-    	world.w = rand()%100*10; world.w/=100; world.w+=.5;
-		world.j = rand()%100*10; world.j/=100; world.j+=.5;
-	}
-	//MURPHY LIGHT
-	if (makeRand == 10){
-		printf("MURPHY LIGHT\n");
-		world.red = 1.03226; world.gre = 1.30968; world.blu = 0.812903;
-		world.q = 1.24; world.w = 1.46; world.j = 0.61;
-	}
-	//GRAYED
-	if (makeRand == 11){
-		printf("GRAYED\n");
-		world.q = rand()%100; world.q/=100; world.q+=.5;
-    	world.w = rand()%100; world.w/=100; world.w+=.5;
-		world.j = rand()%100; world.j/=100; world.j+=.5;
-		world.red = .7;
-		world.gre = .7;
-		world.blu = .7;
-	}
-	//BLUE DESERT
-	if (makeRand == 12){
-		printf("BLUE DESERT\n");
-		world.red = 230/255.0; world.gre = 255/255.0; world.blu = 171/255.0;
-		world.q = 1.41; world.w = 0.79; world.j = 0.14;
-	}
-	//RED DESERT
-	if (makeRand == 13){
-		printf("RED DESERT\n");
-		world.red = 216/255.0; world.gre = 255/255.0; world.blu = 151/255.0;
-		world.q = .4; world.w = 1.11; world.j = 1.1;
-	}
-	
+	if (world_color < 0 || world_color >= (int)presets.size()) world_color = 0;
+	selectPreset(world_color, false);
+	watchFile(presetsFile, reloadPresets);
+	watchShaders();
 
 	cout << "world.red = " << world.red << "; world.gre = " << 
 		world.gre << "; world.blu = " << world.blu << ";" << endl;
-
-	if (makeRand != 10 && makeRand != 13){
-		glClearColor(world.red,world.gre,world.blu,1.0);
-	}else{
-		//light blue sky
-		glClearColor(180/255.0, 223/255.0,  219/255.0,  1.0);
-	}
+	cout << "world.q = " << 
+		world.q << "; world.w = " << world.w 
+		<< "; world.j = " <<  world.j << ";" << endl;
 
     //glClearColor( 80.0/255.0, 170/255.0, 220.0/255.0, 1.0 );
     glViewport( 0, 0, WIDTH, HEIGHT );
@@ -1353,30 +4871,41 @@ int main(int argc, char** argv)
     //VAO?
     glGenVertexArrays( 1, &vao );
     glBindVertexArray( vao );
+    labelObject(GL_VERTEX_ARRAY, vao, "vao");
 
 
     //Storage Locations for Uniforms
-    u.Translation = glGetUniformLocation( program, "u_Translation" );
-	u.ProjMatrix = glGetUniformLocation( program, "u_ProjMatrix");
-	u.ViewMatrix = glGetUniformLocation( program, "u_ViewMatrix");
-	u.ModelMatrix = glGetUniformLocation( program, "u_ModelMatrix");
-	u.Sampler = glGetUniformLocation( program, "u_Sampler");
-	u.Time = glGetUniformLocation( program, "u_Time");
+    initUniforms(u, program);
+    initUniforms(ui, instanceProgram);
 
-    //Storage locations for Attributes
-    glBindAttribLocation( program, a_Position, "a_Position" );
-    glBindAttribLocation( program, a_Color, "a_Color" );
-    glBindAttribLocation( program, a_TexCoord, "a_TexCoord" );
+    //Block compressed formats baked files may use (../Bake)
+    bakedFormats[BAKED_BC1] = bakedFormats[BAKED_BC3] = GLEW_EXT_texture_compression_s3tc;
+    bakedFormats[BAKED_BC7] = GLEW_ARB_texture_compression_bptc;
+
+    Trace array("texture array");
+    initLayers();
+    array.stop();
+    initGpuTimer();
+    initHud();
+    printf("Shaders: %d programs, %d from cache, %.1f ms\n",
+    	shaderStats.programs, shaderStats.cached, shaderStats.ms);
+
+    //Texture decoding and land generation run in the background from here on
+    startWorkers();
+    atexit(stopWorkers);
 
     //Buffers (a_ attributes)
+    Trace meshes("meshes");
     initPlane(onePlane, "None");
-    initLand(oneLand, "None", 1, 1);
-    initLand(twoLand, "None", 1, 0);
-    initLand(threeLand, "None", 0, 0);
-    initLand(fourLand, "None", 0, 1);
     initCube(oneCube, "../old_trinity.png");
-
-    glutTimerFunc(1000.0/60.0, display, 1);
+    labelPrimitive(onePlane, "plane");
+    labelPrimitive(oneCube, "cube");
+    initScene();
+    initProps();
+    meshes.stop();
+    updateChunks();
+
+    glutTimerFunc(frameInterval(), display, 1);
     glutMainLoop();
 
     return 0;
@@ -0,0 +1,67 @@
+#version 130
+in vec4 v_Color;
+
+uniform sampler2DArray u_Sampler;
+uniform float u_Layer;
+varying vec2 v_TexCoord;
+uniform float u_Time;
+
+//Noise is only compiled into variants that use it
+//http://webstaff.itn.liu.se/~stegu/jgt2012/article.pdf
+#if defined(STRIPES) || defined(TURB)
+vec3 permute(vec3 x){
+	return mod(((x*34.0)+1.0)*x, 289.0);
+}
+
+vec3 taylorInvSqrt(vec3 r){
+	return 1.79284291400159 - 0.85373472095314 * r;
+}
+
+float noise(vec2 P){
+	const vec2 C = vec2(0.21132486540518713, 0.36602540378443859);
+	vec2 i = floor(P + dot(P, C.yy) );
+	vec2 x0 = P - i + dot(i, C.xx);
+	vec2 i1;
+	i1.x = step( x0.y, x0.x );
+	i1.y = 1.0 - i1.x;
+	vec4 x12 = x0.xyxy +  vec4( C.xx, C.xx * 2.0 - 1.0);
+	x12.xy -= i1;
+	i = mod(i, 289.0);
+	vec3 p = permute( permute( i.y + vec3(0.0, i1.y, 1.0 )) + i.x + vec3(0.0, i1.x, 1.0 ));
+	vec3 m = max(0.5 - vec3(dot(x0,x0), dot(x12.xy, x12.xy), dot(x12.zw, x12.zw)), 0.0);
+	m = m*m;
+	m = m*m;
+	vec3 x = fract(p*(1.0/41.0)) * 2.0 - 1.0;
+	vec3 gy = abs(x)-0.5;
+	vec3 ox = floor(x + 0.5);
+	vec3 gx = x - ox;
+	m *= taylorInvSqrt( gx*gx + gy*gy );
+	vec3 g;
+	g.x = gx.x * x0.x + gy.x * x0.y;
+	g.yz = gx.yz * x12.xz + gy.yz * x12.yw;
+	return 130.0 * dot(m, g);
+}
+
+float turb(float cx, float cy){
+	return .5 * noise(vec2(cx,cy)) + .25 * noise(vec2(2*cx,2*cy)) + .125 * noise(vec2(4*cx,4*cy));
+}
+
+#endif
+
+void main(){
+	vec4 color = texture(u_Sampler, vec3(v_TexCoord, u_Layer));
+	gl_FragColor = v_Color * vec4(color.rgb, color.a);
+#if defined(STRIPES) || defined(TURB)
+	float cx = v_TexCoord.x;
+	float cy = v_TexCoord.y;
+#endif
+#ifdef STRIPES
+	float n = (1 + sin((cx+cy + noise( vec2(cx/4 ,cy/16) ) * .5) * 50)) * .5;
+	gl_FragColor = gl_FragColor * vec4(vec3(.75 + .25 * n), 1.0);
+#endif
+#ifdef TURB
+	//float m = (1 + sin((cx+cy + sin(u_Time*.01) * turb(cx*10,cy*5) *.1) * 50))/2;
+	float m = (1 + sin((cx + turb(cx,cy) * .1) * 25)) * .5;
+	gl_FragColor = gl_FragColor + vec4( m,m,m, 0.0) * .25;
+#endif
+}
@@ -0,0 +1,24 @@
+#version 130
+
+uniform vec4 u_Translation;
+uniform mat4 u_ViewMatrix;
+uniform mat4 u_ProjMatrix;
+uniform mat4 u_ModelMatrix;
+
+uniform vec3 u_Base;
+uniform vec3 u_RidgeTint;
+uniform bool u_Paletted;
+
+in vec4 a_Position;
+in vec4 a_Color;
+in float a_Ridge;
+in vec2 a_TexCoord;
+out vec4 v_Color;
+
+varying vec2 v_TexCoord;
+
+void main() {
+	gl_Position = a_Position * u_ModelMatrix * u_ViewMatrix * u_ProjMatrix;
+	v_Color = u_Paletted ? vec4(u_Base - a_Ridge * u_RidgeTint, 1.0) : a_Color;
+	v_TexCoord = a_TexCoord;
+}
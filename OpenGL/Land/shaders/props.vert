@@ -0,0 +1,26 @@
+#version 130
+
+//Props: one draw per batch, per-instance model matrix and tint. The tint is
+//palette relative: (ridge, brightness, invert, alpha).
+
+uniform mat4 u_ViewMatrix;
+uniform mat4 u_ProjMatrix;
+uniform vec3 u_Base;
+uniform vec3 u_RidgeTint;
+
+in vec4 a_Position;
+in vec4 a_Color;
+in vec2 a_TexCoord;
+in mat4 a_InstanceMatrix;
+in vec4 a_InstanceColor;
+out vec4 v_Color;
+
+varying vec2 v_TexCoord;
+
+void main() {
+	gl_Position = (a_InstanceMatrix * a_Position) * u_ViewMatrix * u_ProjMatrix;
+	vec3 land = u_Base - a_InstanceColor.x * u_RidgeTint;
+	vec3 tint = mix(land * a_InstanceColor.y, 1.2 - land, a_InstanceColor.z);
+	v_Color = vec4(tint, a_InstanceColor.w) * (0.75 + 0.25 * a_Color);
+	v_TexCoord = a_TexCoord;
+}
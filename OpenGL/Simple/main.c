@@ -14,8 +14,9 @@
 
 using namespace std;
 
-const int WIDTH = 640;
-const int HEIGHT = 480;
+int WIDTH = 640;
+int HEIGHT = 480;
+int frames = 0; //--frames: exit after this many, 0 runs forever
 
 static const char* vertex_source = 
     "   #version 130 \n" 
@@ -68,10 +69,10 @@ struct Matrix4 {
     }
 
     //Copies Matrix to another
-    void copyFrom(Matrix4 old){
+    void copyFrom(const Matrix4 &old){
         //float e[16];
         for(int n = 0; n < 16; n++){
-            elements[n] = old.elements[16-n];
+            elements[n] = old.elements[n];
         }
         //elements = &e;
     }
@@ -256,19 +257,19 @@ struct Matrix4 {
 		float rd, s, ct;
 
 		if (near == far || aspect == 0) {
-			cerr << 'null frustum' << endl;
+			cerr << "null frustum" << endl;
 		}
 		if (near <= 0) {
-			cerr << 'near <= 0' << endl;
+			cerr << "near <= 0" << endl;
 		}
 		if (far <= 0) {
-			cerr << 'far <= 0' << endl;
+			cerr << "far <= 0" << endl;
 		}
 
 		fovy = M_PI * fovy / 180.0 / 2.0;
   		s = sin(fovy);
 		if (s == 0) {
-			cerr << 'null frustum' << endl;
+			cerr << "null frustum" << endl;
 		}
 
 		rd = 1.0 / (far - near);
@@ -470,6 +471,9 @@ void display(int te){
     glClear(GL_COLOR_BUFFER_BIT);
     glutTimerFunc(1000.0/60.0, display, 1);
 
+    static int frame = 0;
+    if (frames > 0 && frame++ >= frames) exit(0);
+
     u.Tx += 1;
     glUniform4f(u.Translation, u.Tx, u.Ty, u.Tz, 0.0);
 
@@ -500,6 +504,16 @@ void display(int te){
 
 int main(int argc, char** argv)
 {
+    //--width W --height H --frames N; anything else is left for GLUT
+    for (int n = 1; n + 1 < argc; n++){
+        if (strcmp(argv[n], "--width") == 0) WIDTH = atoi(argv[++n]);
+        else if (strcmp(argv[n], "--height") == 0) HEIGHT = atoi(argv[++n]);
+        else if (strcmp(argv[n], "--frames") == 0) frames = atoi(argv[++n]);
+    }
+    if (WIDTH < 1 || HEIGHT < 1){
+        fprintf(stderr, "width and height must be positive\n");
+        return 1;
+    }
 
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);